@@ -0,0 +1,92 @@
+#ifndef TVTERM_COALESCE_H
+#define TVTERM_COALESCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <chrono>
+
+namespace tvterm
+{
+
+// What a TerminalCoalescingPolicy knows about a terminal when the client
+// sends it data.
+struct TerminalCoalescingInput
+{
+    // Bytes per second received from the client, averaged over the last few
+    // tenths of a second.
+    uint64_t inputRate;
+    bool focused;
+    // Whether any part of the terminal can be seen by the user.
+    bool visible;
+};
+
+// After data is received from the client, the TerminalState is not updated
+// until no more data arrives within 'waitStep', or until 'maxWait' has
+// elapsed since the first data was received, whichever comes first. Longer
+// waits convert fewer intermediate frames; shorter ones show the data sooner.
+struct TerminalCoalescingDelays
+{
+    std::chrono::microseconds waitStep;
+    std::chrono::microseconds maxWait;
+};
+
+// Decides how much the updates caused by client data are coalesced. A policy
+// may be shared by several TerminalControllers, so 'getDelays' is invoked
+// concurrently and must not modify the policy.
+
+class TerminalCoalescingPolicy
+{
+public:
+
+    virtual const char *getName() const noexcept = 0;
+    virtual TerminalCoalescingDelays getDelays(const TerminalCoalescingInput &input) const noexcept = 0;
+
+    // Returns the policy used when none is specified, which is an
+    // AdaptiveCoalescingPolicy.
+    static const TerminalCoalescingPolicy &getDefault() noexcept;
+};
+
+// Waits little while the client sends little data (e.g. the echo of what
+// the user types), and more while it floods the terminal, in which case
+// intermediate frames are not worth converting. Terminals which are not
+// focused wait longer, and terminals which cannot be seen wait much longer.
+
+class AdaptiveCoalescingPolicy : public TerminalCoalescingPolicy
+{
+public:
+
+    // Clients sending more than this many bytes per second are considered
+    // to be flooding the terminal.
+    enum : uint64_t { bulkInputRate = 64*1024 };
+
+    const char *getName() const noexcept override;
+    TerminalCoalescingDelays getDelays(const TerminalCoalescingInput &input) const noexcept override;
+};
+
+// Always uses the same delays. Useful for benchmarking. The default delays
+// are those tvterm has traditionally used.
+
+class FixedCoalescingPolicy : public TerminalCoalescingPolicy
+{
+public:
+
+    FixedCoalescingPolicy( std::chrono::microseconds waitStep = std::chrono::milliseconds(5),
+                           std::chrono::microseconds maxWait = std::chrono::milliseconds(20) ) noexcept;
+
+    const char *getName() const noexcept override;
+    TerminalCoalescingDelays getDelays(const TerminalCoalescingInput &input) const noexcept override;
+
+private:
+
+    TerminalCoalescingDelays delays;
+};
+
+inline FixedCoalescingPolicy::FixedCoalescingPolicy( std::chrono::microseconds waitStep,
+                                                     std::chrono::microseconds maxWait ) noexcept :
+    delays {waitStep, maxWait}
+{
+}
+
+} // namespace tvterm
+
+#endif // TVTERM_COALESCE_H
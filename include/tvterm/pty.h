@@ -51,9 +51,18 @@ public:
     PtyMaster(PtyDescriptor ptyDescriptor) noexcept;
 
     bool readFromClient(TSpan<char> data, size_t &bytesRead) noexcept;
-    bool writeToClient(TSpan<const char> data) noexcept;
+    // Writes as much of 'data' as the client can take without blocking, except
+    // on Windows, where all of it is written. Returns false on error.
+    bool writeToClient(TSpan<const char> data, size_t &bytesWritten) noexcept;
+    // Waits until more data can be written or 'timeoutMs' have passed.
+    void waitUntilWritable(int timeoutMs) noexcept;
     void resizeClient(TPoint size) noexcept;
     void disconnect() noexcept;
+
+#if !defined(_WIN32)
+    // For use with I/O multiplexing. The descriptor remains owned by 'this'.
+    int getMasterFd() const noexcept;
+#endif
 };
 
 inline PtyMaster::PtyMaster(PtyDescriptor ptyDescriptor) noexcept :
@@ -61,6 +70,13 @@ inline PtyMaster::PtyMaster(PtyDescriptor ptyDescriptor) noexcept :
 {
 }
 
+#if !defined(_WIN32)
+inline int PtyMaster::getMasterFd() const noexcept
+{
+    return d.masterFd;
+}
+#endif
+
 } // namespace tvterm
 
 #endif // TVTERM_PTY_H
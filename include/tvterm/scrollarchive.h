@@ -0,0 +1,125 @@
+#ifndef TVTERM_SCROLLARCHIVE_H
+#define TVTERM_SCROLLARCHIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <tvterm/scrollback.h>
+
+namespace tvterm
+{
+
+// Scrollback lines stored in a directory, so that they survive the process.
+//
+// Lines are appended to segment files of a fixed size which are mapped into
+// memory, so that they can be accessed in place and the operating system
+// decides which parts remain in memory. Each segment begins with a small
+// header and grows in two directions: the encoded lines are written from the
+// front and the offset of each line is written from the back. Opening an
+// archive only requires mapping its segments, regardless of how many lines
+// they contain.
+//
+// A segment's header is only updated after the line has been written, so a
+// line which was being written when the process died is simply ignored. The
+// data is left in the page cache to be written back by the operating system,
+// so it survives the process crashing but not necessarily the system.
+//
+// While open, the directory is locked so that it cannot be used by another
+// process. Not available on Windows.
+
+class ScrollbackArchive
+{
+public:
+
+    enum : size_t
+    {
+        segmentSize = 16*1024*1024,
+        // Lines are cheap to keep on disk, so archives can keep many more
+        // than ScrollbackStore::defaultMaxLines.
+        defaultMaxLines = 1000000,
+    };
+
+    // Opens the archive in 'dir', creating the directory if it does not
+    // exist. Returns null on error.
+    static ScrollbackArchive *open(const char *dir) noexcept;
+    // Creates a new directory for an archive within 'baseDir' and returns its
+    // path, or an empty string on error.
+    static std::string createDirectory(const char *baseDir) noexcept;
+    // Returns the directories of the archives within 'baseDir' which are not
+    // open in any process, most recently modified last.
+    static std::vector<std::string> findUnused(const char *baseDir) noexcept;
+
+    ~ScrollbackArchive();
+
+    ScrollbackArchive(const ScrollbackArchive &) = delete;
+    ScrollbackArchive &operator=(const ScrollbackArchive &) = delete;
+
+    // The range of ids of the lines in the archive.
+    size_t beginLine() const noexcept;
+    size_t endLine() const noexcept;
+
+    // Returns false on error, in which case the line is not stored.
+    bool push(TSpan<const ScrollbackSpan> spans, TStringView text, bool wrapped) noexcept;
+    // The line points into the mapped file and remains valid until the
+    // archive is modified.
+    bool getLine(size_t id, ScrollbackLine &line) const noexcept;
+    // Pre: the archive is not empty.
+    void pop() noexcept;
+    // Discards the lines before 'id'. Segments are deleted once all of their
+    // lines have been discarded.
+    void discardBefore(size_t id) noexcept;
+
+    // Makes the directory and its contents be deleted when the archive is
+    // destroyed, e.g. because the terminal was closed by the user.
+    void removeOnClose() noexcept;
+
+private:
+
+    struct SegmentHeader;
+
+    struct Segment
+    {
+        char *data;
+        size_t size;
+        std::string path;
+
+        SegmentHeader &header() const noexcept;
+        uint32_t &offset(size_t i) const noexcept;
+    };
+
+    std::string dir;
+    int lockFd;
+    size_t lineBegin {0};
+    size_t lineEnd {0};
+    std::deque<Segment> segments;
+    bool removeFiles {false};
+
+    ScrollbackArchive(std::string &&aDir, int aLockFd) noexcept;
+
+    static bool isValidSegment(const Segment &segment) noexcept;
+    bool load() noexcept;
+    bool addSegment(size_t minSize) noexcept;
+    void removeSegment(Segment &segment) noexcept;
+};
+
+inline size_t ScrollbackArchive::beginLine() const noexcept
+{
+    return lineBegin;
+}
+
+inline size_t ScrollbackArchive::endLine() const noexcept
+{
+    return lineEnd;
+}
+
+inline void ScrollbackArchive::removeOnClose() noexcept
+{
+    removeFiles = true;
+}
+
+} // namespace tvterm
+
+#endif // TVTERM_SCROLLARCHIVE_H
@@ -0,0 +1,348 @@
+#ifndef TVTERM_SCROLLBACK_H
+#define TVTERM_SCROLLBACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <tvision/tv.h>
+
+namespace tvterm
+{
+
+// A sequence of cells with the same attributes and layout within a
+// scrollback line.
+struct ScrollbackSpan
+{
+    // Number of cells in the span. All of them are 'width' columns wide.
+    uint16_t cells;
+    uint8_t width;
+    // Number of codepoints in each cell. More than one means combining
+    // characters, and zero means the cells are empty.
+    uint8_t codepoints;
+    // Size in bytes of the span's UTF-8 text.
+    uint16_t textSize;
+    // The attributes the cells are displayed with.
+    TColorAttr attr;
+    // Emulator-specific attributes, preserved verbatim so that lines can be
+    // returned to the emulator exactly as they were.
+    uint32_t emulatorAttrs[3];
+};
+
+struct ScrollbackLine
+{
+    TSpan<const ScrollbackSpan> spans;
+    // The text of all the spans, one after the other.
+    TStringView text;
+    // Whether the line continues in the next one, because it was wrapped by
+    // the terminal rather than ended by the application.
+    bool wrapped {false};
+};
+
+// Draws 'line' into 'cells', and fills the rest of them with blanks.
+void drawScrollbackLine(TSpan<TScreenCell> cells, const ScrollbackLine &line) noexcept;
+// Returns the number of columns taken by 'line'.
+size_t getScrollbackLineWidth(const ScrollbackLine &line) noexcept;
+
+class ScrollbackStore;
+class ScrollbackArchive;
+
+// A limit on the memory taken by all the ScrollbackStores in the process.
+//
+// The budget has a low-priority background thread which compresses the blocks
+// of the stores once they have not been used for a while. If the limit is
+// still exceeded, the oldest blocks of the stores which were viewed least
+// recently are moved into a temporary file. Blocks are decompressed or read
+// back when somebody needs them. Storing lines never has to wait for the
+// background thread. While the system is under memory pressure (as reported
+// by Linux's Pressure Stall Information), the limit is lowered.
+
+class ScrollbackBudget
+{
+public:
+
+    enum : size_t { defaultLimit = 64*1024*1024 };
+
+    // Returns the process-wide ScrollbackBudget. It is never destroyed.
+    static ScrollbackBudget &getShared() noexcept;
+
+    // Thread-safe.
+    void setLimit(size_t bytes) noexcept;
+    // Returns the amount of memory currently taken by the stores.
+    size_t getUsage() const noexcept;
+
+private:
+
+    friend class ScrollbackStore;
+
+    struct SpillFile;
+
+    std::atomic<size_t> limit {defaultLimit};
+    // The limit, lowered according to the memory pressure.
+    std::atomic<size_t> effectiveLimit {defaultLimit};
+    std::atomic<size_t> usage {0};
+    std::atomic<uint64_t> clock {0};
+
+    // The background thread does not hold 'storesMutex' while it moves blocks
+    // out of memory. Instead, the store it is working on is 'busyStore', and
+    // stores wait for it to be done with them before they are detached.
+    std::mutex storesMutex;
+    std::condition_variable storesCondVar;
+    std::vector<ScrollbackStore *> stores;
+    ScrollbackStore *busyStore {nullptr};
+
+    std::mutex threadMutex;
+    std::condition_variable threadCondVar;
+    bool wakeUpRequested {false};
+    bool threadStarted {false};
+
+    std::mutex fileMutex;
+    std::unique_ptr<SpillFile> file;
+
+    ScrollbackBudget() noexcept;
+    ~ScrollbackBudget();
+
+    void attach(ScrollbackStore &store) noexcept;
+    void detach(ScrollbackStore &store) noexcept;
+    bool acquireStore(ScrollbackStore &store) noexcept;
+    void releaseStore() noexcept;
+    uint64_t tick() noexcept;
+    void allocated(size_t bytes) noexcept;
+    void released(size_t bytes) noexcept;
+    void wakeUp() noexcept;
+    void run() noexcept;
+    void compressColdBlocks(uint64_t horizon) noexcept;
+    void spillColdest() noexcept;
+
+    // The temporary file. Return false on error.
+    bool writeSpill(const char *data, size_t size, uint64_t &offset) noexcept;
+    bool readSpill(uint64_t offset, char *data, size_t size) noexcept;
+    void releaseSpill(uint64_t offset, size_t size) noexcept;
+};
+
+inline size_t ScrollbackBudget::getUsage() const noexcept
+{
+    return usage.load(std::memory_order_relaxed);
+}
+
+inline uint64_t ScrollbackBudget::tick() noexcept
+{
+    return clock.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+// Storage for the lines scrolled off the top of a terminal screen.
+//
+// Lines are stored one after the other in large blocks of memory, as a list
+// of attribute spans followed by their UTF-8 text, so that the memory taken by
+// a line depends on its contents rather than on the width of the terminal,
+// and storing a line does not require a memory allocation of its own. The
+// memory of all the stores is subject to a ScrollbackBudget, which may move
+// blocks out of memory at any time the store is not locked.
+//
+// Alternatively, the lines can be kept in a ScrollbackArchive, in which case
+// the budget does not apply to them.
+//
+// Lines are identified by their position since the store was created, which
+// does not change when older lines are discarded. Lines are removed either
+// from the beginning, when the store is full, or from the end, when the
+// emulator takes them back (e.g. because the screen grew taller).
+//
+// Lines which were wrapped by the terminal are joined back together into
+// logical lines, so that they can be displayed at a different width. This is
+// done on demand, only for the lines being looked at, so that the store does
+// not need to do anything when the terminal is resized.
+
+class ScrollbackStore
+{
+public:
+
+    enum
+    {
+        defaultMaxLines = 100000,
+        // Logical lines are split every this many lines, so that a program
+        // which never ends its lines does not make the store join all of
+        // them together.
+        maxLogicalLines = 256,
+    };
+
+    // 'budget' may be null, in which case memory usage is not limited.
+    ScrollbackStore( size_t aMaxLines = defaultMaxLines,
+                     ScrollbackBudget *aBudget = &ScrollbackBudget::getShared() ) noexcept;
+    ~ScrollbackStore();
+
+    ScrollbackStore(const ScrollbackStore &) = delete;
+    ScrollbackStore &operator=(const ScrollbackStore &) = delete;
+
+    // Invokes 'func' with the store locked. The store may be used by several
+    // threads, so it must only be accessed this way.
+    // * 'func' takes a 'ScrollbackStore &' by parameter.
+    template <class Func>
+    auto lock(Func &&func);
+
+    // The range of ids of the lines in the store.
+    size_t beginLine() const noexcept;
+    size_t endLine() const noexcept;
+    bool empty() const noexcept;
+
+    // Appends a line, discarding the oldest one if the store is full.
+    // 'wrapped' is as in ScrollbackLine.
+    void push(TSpan<const ScrollbackSpan> spans, TStringView text, bool wrapped) noexcept;
+    // Retrieves the line with the given id, reading it back into memory if
+    // necessary. The line remains valid until the store is unlocked or
+    // modified. Returns false if there is no such line or it could not be
+    // read.
+    bool getLine(size_t id, ScrollbackLine &line) noexcept;
+    // Removes the most recent line.
+    // Pre: the store is not empty.
+    void pop() noexcept;
+    // Return the range of ids of the logical line containing the line with
+    // the given id.
+    // Pre: beginLine() <= id < endLine().
+    size_t logicalLineBegin(size_t id) noexcept;
+    size_t logicalLineEnd(size_t id) noexcept;
+    // Draws the lines in the range [begin, end) one after the other into
+    // 'cells', wrapping them at 'width' columns. 'cells' is resized to hold
+    // the rows, which are 'width' cells each. Returns the number of rows,
+    // which is at least one.
+    // Pre: width > 0.
+    size_t drawWrapped( size_t begin, size_t end, size_t width,
+                        std::vector<TScreenCell> &cells ) noexcept;
+    // Returns when the line with the given id was added, in seconds since the
+    // epoch, or 0 if not known (e.g. it was restored from an archive).
+    int64_t getLineTime(size_t id) const noexcept;
+
+    // Records that the user is looking at the store, which makes it less
+    // likely to be moved out of memory.
+    void markViewed() noexcept;
+
+    // Makes the store keep its lines in 'archive' from now on, starting
+    // with the lines already in the archive. Takes ownership of 'archive'.
+    // Pre: the store is empty.
+    void useArchive(ScrollbackArchive *archive, size_t aMaxLines) noexcept;
+    // If the store uses an archive, makes it be deleted along with the store.
+    void removeArchiveOnClose() noexcept;
+
+private:
+
+    friend class ScrollbackBudget;
+
+    enum { blockSize = 64*1024 };
+
+    struct Block
+    {
+        // Null if the block is not in memory uncompressed.
+        char *data;
+        size_t capacity;
+        size_t used;
+        // Id of the first line stored in the block, even if it was discarded.
+        size_t firstLine;
+        // Position of each line in 'data'.
+        std::vector<uint32_t> offsets;
+        // When the block was last accessed, according to the budget's clock.
+        uint64_t lastUsed;
+        // Incremented every time lines are written into the block.
+        uint32_t version;
+        bool incompressible;
+        // Once the block has a compressed or spilled copy, it is not written
+        // into anymore, so that the copy remains valid until the block is
+        // freed. 'copySize' is the size of the contents in the copy.
+        size_t copySize;
+        // Compressed copy, if in memory.
+        char *compressed;
+        size_t compressedSize;
+        // Location of the copy in the spill file, if it was written there.
+        bool spilled;
+        bool spillCompressed;
+        uint64_t spillOffset;
+        size_t spillSize;
+    };
+
+    // The lines added since 'line' were added at time 'time' or later.
+    struct TimeMark
+    {
+        size_t line;
+        int64_t time;
+    };
+
+    // Identifies a block that is being compressed or spilled without the lock
+    // held.
+    struct BlockVersion
+    {
+        size_t firstLine;
+        uint32_t version;
+        size_t size;
+    };
+
+    std::mutex mutex;
+    size_t maxLines;
+    ScrollbackBudget *budget;
+    size_t lineBegin {0};
+    size_t lineEnd {0};
+    std::deque<Block> blocks;
+    std::unique_ptr<ScrollbackArchive> archive;
+    // One mark per second in which lines were added, at most.
+    std::deque<TimeMark> timeMarks;
+
+    // Read without the lock by the budget's spiller.
+    std::atomic<uint64_t> lastViewed {0};
+    std::atomic<size_t> residentBytes {0};
+
+    void markTime() noexcept;
+    char *allocateLine(size_t size) noexcept;
+    void discardOldest() noexcept;
+    Block *findBlock(size_t firstLine) noexcept;
+    bool hasCopy(const Block &block) const noexcept;
+    bool loadBlock(Block &block) noexcept;
+    void freeBlockData(Block &block) noexcept;
+    void freeCompressed(Block &block) noexcept;
+    void freeBlock(Block &block) noexcept;
+    uint64_t tick() noexcept;
+    // Finds a block which has not been used since 'horizon' and can be
+    // compressed, and copies its contents into 'buf'. Blocks which were
+    // decompressed and have not been used since are freed meanwhile.
+    bool takeColdBlock(uint64_t horizon, std::vector<char> &buf, BlockVersion &bv) noexcept;
+    // Sets the compressed copy of the block taken by 'takeColdBlock', unless
+    // it changed meanwhile. 'size' is 0 if it could not be compressed.
+    void putCompressedBlock(const BlockVersion &bv, const char *data, size_t size) noexcept;
+    // Finds the least recently used block which is in memory. If it is in the
+    // spill file already, its memory is freed and 'buf' is left empty.
+    // Otherwise, its compressed copy, if any, or else its contents are copied
+    // into 'buf', to be written into the spill file without the lock held.
+    // Returns false if no block can be moved out of memory.
+    bool takeSpillBlock(std::vector<char> &buf, BlockVersion &bv) noexcept;
+    // Records that the copy of the block taken by 'takeSpillBlock' was
+    // written into the spill file at 'offset' and frees its memory. If the
+    // block changed meanwhile, the extent is released instead.
+    void putSpilledBlock(const BlockVersion &bv, uint64_t offset, size_t size) noexcept;
+};
+
+template <class Func>
+inline auto ScrollbackStore::lock(Func &&func)
+{
+    std::lock_guard<std::mutex> lk {mutex};
+    return func(*this);
+}
+
+inline size_t ScrollbackStore::beginLine() const noexcept
+{
+    return lineBegin;
+}
+
+inline size_t ScrollbackStore::endLine() const noexcept
+{
+    return lineEnd;
+}
+
+inline bool ScrollbackStore::empty() const noexcept
+{
+    return lineBegin == lineEnd;
+}
+
+} // namespace tvterm
+
+#endif // TVTERM_SCROLLBACK_H
@@ -0,0 +1,117 @@
+#ifndef TVTERM_SCROLLFIND_H
+#define TVTERM_SCROLLFIND_H
+
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <tvterm/scrollback.h>
+
+namespace tvterm
+{
+
+// Searches the lines of a ScrollbackStore for some text, in a thread of its
+// own.
+//
+// Lines are searched from the most recent to the oldest, a chunk at a time,
+// so that the store is never locked for long. The lines found so far can be
+// retrieved at any time. When the new text extends the previous one (e.g.
+// because the user typed one more character), only the lines found by the
+// previous search and the lines added since then are searched.
+//
+// The search is case-insensitive unless the text contains uppercase
+// letters. Text does not match across cells which were never written into,
+// but it does match across lines wrapped by the terminal, in which case the
+// line where the text begins is the one found.
+
+class ScrollbackFinder
+{
+public:
+
+    struct Results
+    {
+        // Ids of the lines containing the text, from the most recent to the
+        // oldest.
+        std::vector<size_t> lines;
+        bool done {true};
+    };
+
+    ScrollbackFinder() noexcept = default;
+    // Cancels the search, if any.
+    ~ScrollbackFinder();
+
+    // Starts searching 'store' for 'text', cancelling the previous search.
+    // 'store' must remain alive until the search is cancelled.
+    void start(ScrollbackStore &store, TStringView text) noexcept;
+    // Waits for the search to stop.
+    void cancel() noexcept;
+
+    // Returns whether the results have changed since the last time this was
+    // invoked.
+    bool resultsChanged() noexcept;
+
+    template <class Func>
+    // Invokes 'func' with the results found so far.
+    // * 'func' takes a 'const Results &' by parameter.
+    auto useResults(Func &&func);
+
+    // Returns whether 'text' should be searched for ignoring case.
+    static bool ignoresCase(TStringView text) noexcept;
+
+    // The store is locked for at most this many lines at a time.
+    enum { chunkLines = 4096 };
+
+private:
+
+    std::thread thread;
+    std::atomic<bool> cancelled {false};
+    std::atomic<bool> changed {false};
+    std::mutex mutex;
+    Results results;
+
+    // The text of the last search and the end of the lines it looked at.
+    std::string lastText;
+    size_t lastEnd {0};
+
+    void run( ScrollbackStore &store, std::string text,
+              std::vector<size_t> candidates, size_t candidatesEnd ) noexcept;
+    void publish(std::vector<size_t> &found, bool done) noexcept;
+};
+
+struct ScrollbackMatch
+{
+    // Position of the store in which the line was found.
+    size_t store;
+    size_t line;
+    // As returned by ScrollbackStore::getLineTime().
+    int64_t time;
+    // The beginning of the line's text.
+    std::string text;
+};
+
+// Searches all the 'stores' for 'text' like a ScrollbackFinder, using one
+// thread per core, and returns up to 'maxMatches' of the lines found, from
+// the most to the least recently added. Lines added in the same second keep
+// the order of 'stores'.
+std::vector<ScrollbackMatch> findInScrollbacks( TSpan<ScrollbackStore *const> stores,
+                                                TStringView text,
+                                                size_t maxMatches ) noexcept;
+
+template <class Func>
+inline auto ScrollbackFinder::useResults(Func &&func)
+{
+    std::lock_guard<std::mutex> lock {mutex};
+    return func((const Results &) results);
+}
+
+inline bool ScrollbackFinder::resultsChanged() noexcept
+{
+    return changed.exchange(false) == true;
+}
+
+} // namespace tvterm
+
+#endif // TVTERM_SCROLLFIND_H
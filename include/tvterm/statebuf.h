@@ -0,0 +1,87 @@
+#ifndef TVTERM_STATEBUF_H
+#define TVTERM_STATEBUF_H
+
+#include <tvterm/termemu.h>
+#include <atomic>
+#include <vector>
+
+namespace tvterm
+{
+
+// A triple buffer of TerminalStates which allows the TerminalEmulator to
+// publish new frames and the view to read the latest one without either side
+// ever waiting for the other.
+//
+// At any given time, one of the buffers belongs to the producer (the 'back'
+// buffer), one belongs to the consumer (the 'front' buffer), and the third one
+// holds the latest frame not yet picked up by the consumer. Publishing a frame
+// and picking it up are a single atomic exchange each.
+//
+// Because TerminalEmulators only redraw what changed, every frame must contain
+// the whole contents of the previous one. So, before the producer writes into
+// a buffer, the areas which were modified in other buffers since it was last
+// written are copied into it from the last published frame. Likewise, the
+// damage, cursor and title changes of frames the consumer never picked up are
+// carried over to the following ones.
+
+class TerminalStateBuffer
+{
+public:
+
+    // Producer side. Invokes 'func' with a TerminalState which has the
+    // contents of the last published frame, and then publishes it.
+    // * 'func' takes a 'TerminalState &' by parameter.
+    template <class Func>
+    void update(Func &&func) noexcept;
+
+    // Consumer side. Returns the latest published frame. The returned
+    // reference remains valid and the frame does not change until the next
+    // invocation.
+    TerminalState &acquire() noexcept;
+
+private:
+
+    using RowDamage = TerminalSurface::RowDamage;
+
+    enum : uint8_t { indexMask = 3, fresh = 4, none = 3 };
+
+    TerminalState states[3];
+    std::atomic<uint8_t> ready {1};
+
+    // Only accessed by the consumer.
+    uint8_t front {0};
+
+    // Only accessed by the producer.
+    uint8_t back {2};
+    uint8_t lastPublished {none};
+    // Areas modified since each buffer was last written by the producer.
+    std::vector<RowDamage> staleDamage[3];
+    // Changes of the frames which may not have been picked up by the
+    // consumer.
+    std::vector<RowDamage> carriedDamage;
+    bool carriedCursorChange {false};
+    bool carriedTitleChange {false};
+    GrowArray carriedTitle;
+
+    void beginUpdate() noexcept;
+    void endUpdate() noexcept;
+};
+
+template <class Func>
+inline void TerminalStateBuffer::update(Func &&func) noexcept
+{
+    beginUpdate();
+    func(states[back]);
+    endUpdate();
+}
+
+inline TerminalState &TerminalStateBuffer::acquire() noexcept
+{
+    if (ready.load(std::memory_order_relaxed) & fresh)
+        front = ready.exchange(front, std::memory_order_acq_rel) & indexMask;
+    return states[front];
+}
+
+} // namespace tvterm
+
+#endif // TVTERM_STATEBUF_H
@@ -5,13 +5,75 @@
 #include <tvision/tv.h>
 
 #include <tvterm/termemu.h>
+#include <tvterm/coalesce.h>
 #include <tvterm/pty.h>
+#include <tvterm/statebuf.h>
+#include <stdint.h>
 #include <atomic>
 #include <memory>
+#include <mutex>
 
 namespace tvterm
 {
 
+enum class TerminalIoBackend
+{
+    // Each terminal gets its own reader and writer threads. Available
+    // everywhere.
+    Threads,
+    // Terminals share a small, fixed set of reactor threads which multiplex
+    // all the pseudoterminals with epoll, and a pool of as many threads as
+    // there are cores which performs the emulation. Linux only. Falls back to
+    // 'Threads' when not supported.
+    Epoll,
+    // Like 'Epoll', but reads and writes are submitted through io_uring, with
+    // multishot reads into a registered buffer ring. Linux only. Falls back
+    // to 'Epoll' if the kernel lacks support.
+    IoUring,
+};
+
+struct TerminalControllerOptions
+{
+    TerminalIoBackend ioBackend {TerminalIoBackend::Threads};
+    // Data read from the client is buffered until it can be parsed by the
+    // TerminalEmulator. This is the maximum amount of data to buffer (rounded
+    // up to a power of two) before we stop reading.
+    size_t inputBufferCapacity {1024*1024};
+    // Decides how long updates are held back while the client sends data.
+    // Must outlive the TerminalController. If null,
+    // 'TerminalCoalescingPolicy::getDefault()' is used.
+    const TerminalCoalescingPolicy *coalescingPolicy {nullptr};
+};
+
+// Statistics about the events sent to a TerminalController.
+struct TerminalEventCounters
+{
+    uint64_t received {0};
+    // Events which were merged into a later one of the same kind before
+    // reaching the TerminalEmulator: mouse moves with the same buttons
+    // pressed, focus changes and resizes.
+    uint64_t mouseMovesCoalesced {0};
+    uint64_t focusChangesCoalesced {0};
+    uint64_t resizesCoalesced {0};
+};
+
+// Statistics about how the updates caused by client data are coalesced.
+struct TerminalCoalescingCounters
+{
+    // As returned by 'TerminalCoalescingPolicy::getName()'.
+    const char *policy {nullptr};
+    // The input the policy was last given and the delays it chose.
+    TerminalCoalescingInput lastInput {};
+    TerminalCoalescingDelays lastDelays {};
+    // How many times the TerminalState was updated because the client
+    // stopped sending data for 'waitStep', or because 'maxWait' elapsed.
+    uint64_t quietUpdates {0};
+    uint64_t maxWaitUpdates {0};
+    // How many times the TerminalState was updated right after receiving
+    // data, because it followed a key press and was likely its echo.
+    uint64_t echoUpdates {0};
+};
+
 class TerminalController
 {
 public:
@@ -19,8 +81,9 @@ public:
     // Returns a new-allocated TerminalController.
     // On error, invokes the 'onError' callback and returns null.
     static TerminalController *create( TPoint size,
-                                     TerminalEmulatorFactory &terminalEmulatorFactory,
-                                     void (&onError)(const char *reason) ) noexcept;
+                                       TerminalEmulatorFactory &terminalEmulatorFactory,
+                                       void (&onError)(const char *reason),
+                                       const TerminalControllerOptions &options = {} ) noexcept;
     // Takes ownership over 'this'.
     void shutDown() noexcept;
 
@@ -28,27 +91,86 @@ public:
 
     bool stateHasBeenUpdated() noexcept;
     bool clientIsDisconnected() noexcept;
+    // Returns whether the client has not been consuming the data sent to it
+    // (e.g. keystrokes) for a while. Meanwhile, further input is held back.
+    bool clientIsNotReading() noexcept;
+    // Thread-safe.
+    TerminalEventCounters getEventCounters() noexcept;
+    // Thread-safe.
+    TerminalCoalescingCounters getCoalescingCounters() noexcept;
 
     template <class Func>
-    // This method locks a mutex, so reentrance will lead to a deadlock.
+    // Invokes 'func' with every TerminalController which has been updated
+    // since the last invocation (e.g. because the emulator drew something or
+    // the client got disconnected), skipping the ones which have been shut
+    // down. Terminals which are not being updated are not looked at. Must be
+    // invoked from the main thread.
+    //
+    // Once this has been invoked, the main thread is only woken up when the
+    // first controller is added to the list, so it must keep being invoked.
+    // * 'func' takes a 'TerminalController &' by parameter.
+    static void forEachUpdated(Func &&func);
+    // Returns whether 'forEachUpdated' would visit some controller.
+    static bool anyUpdated() noexcept;
+
+    template <class Func>
+    // Invokes 'func' with the latest state published by the emulator. This
+    // never blocks, but it must always be invoked from the same thread.
     // * 'func' takes a 'TerminalState &' by parameter.
-    auto lockState(Func &&func);
+    auto useState(Func &&func);
+
+    template <class Func>
+    // Invokes 'func' with the lines scrolled off the terminal screen, which
+    // the emulator cannot modify in the meantime, and records that the user
+    // is viewing them. Returns false if there is no scrollback.
+    // * 'func' takes a 'ScrollbackStore &' by parameter.
+    bool useScrollback(Func &&func);
 
 private:
 
     struct TerminalEventLoop;
 
     PtyMaster ptyMaster;
-    Mutex<TerminalState> terminalState;
+    TerminalStateBuffer terminalState;
     TerminalEventLoop &eventLoop;
     TerminalEmulator &terminalEmulator;
 
     std::atomic<bool> updated {false};
     std::atomic<bool> disconnected {false};
+    std::atomic<bool> notReading {false};
+
+    struct
+    {
+        std::atomic<uint64_t> received {0};
+        std::atomic<uint64_t> mouseMovesCoalesced {0};
+        std::atomic<uint64_t> focusChangesCoalesced {0};
+        std::atomic<uint64_t> resizesCoalesced {0};
+    } eventCounters;
+
+    // 'coalescingCounters' is protected by 'coalescingMutex', which is only
+    // locked briefly when the counters change or are read.
+    std::mutex coalescingMutex;
+    TerminalCoalescingCounters coalescingCounters;
 
     std::shared_ptr<TerminalController> selfOwningPtr;
 
-    TerminalController(TPoint, TerminalEmulatorFactory &, PtyDescriptor) noexcept;
+    // Controllers which have been updated form a lock-free stack, which the
+    // main thread takes as a whole. A controller is pushed only if it is not
+    // in the stack already, and it is not deleted while it is in it: whoever
+    // clears the last of the two 'listState' flags deletes it.
+    enum : uint8_t { inUpdatedList = 1, released = 2 };
+    static std::atomic<TerminalController *> updatedList;
+    static std::atomic<bool> updatedListUsed;
+    TerminalController *nextUpdated {nullptr};
+    std::atomic<uint8_t> listState {0};
+    bool isShutDown {false}; // Main thread only.
+
+    bool addToUpdatedList() noexcept;
+    static TerminalController *takeUpdatedList() noexcept;
+    bool removeFromUpdatedList() noexcept;
+
+    TerminalController( TPoint, TerminalEmulatorFactory &, PtyDescriptor,
+                        const TerminalControllerOptions & ) noexcept;
     ~TerminalController();
 };
 
@@ -62,12 +184,66 @@ inline bool TerminalController::clientIsDisconnected() noexcept
     return disconnected;
 }
 
+inline bool TerminalController::clientIsNotReading() noexcept
+{
+    return notReading;
+}
+
+inline TerminalEventCounters TerminalController::getEventCounters() noexcept
+{
+    auto &c = eventCounters;
+    TerminalEventCounters counters;
+    counters.received = c.received.load(std::memory_order_relaxed);
+    counters.mouseMovesCoalesced = c.mouseMovesCoalesced.load(std::memory_order_relaxed);
+    counters.focusChangesCoalesced = c.focusChangesCoalesced.load(std::memory_order_relaxed);
+    counters.resizesCoalesced = c.resizesCoalesced.load(std::memory_order_relaxed);
+    return counters;
+}
+
+inline bool TerminalController::anyUpdated() noexcept
+{
+    return updatedList.load(std::memory_order_relaxed) != nullptr;
+}
+
+inline TerminalCoalescingCounters TerminalController::getCoalescingCounters() noexcept
+{
+    std::lock_guard<std::mutex> lock(coalescingMutex);
+    return coalescingCounters;
+}
+
+template <class Func>
+inline void TerminalController::forEachUpdated(Func &&func)
+{
+    TerminalController *ctrl = takeUpdatedList();
+    while (ctrl)
+    {
+        // 'ctrl' may be deleted by 'func' or by 'removeFromUpdatedList'.
+        TerminalController *next = ctrl->nextUpdated;
+        bool skip = ctrl->isShutDown;
+        if (ctrl->removeFromUpdatedList() && !skip)
+            func(*ctrl);
+        ctrl = next;
+    }
+}
+
+template <class Func>
+inline auto TerminalController::useState(Func &&func)
+{
+    return func(terminalState.acquire());
+}
+
 template <class Func>
-inline auto TerminalController::lockState(Func &&func)
+inline bool TerminalController::useScrollback(Func &&func)
 {
-    return terminalState.lock([&] (auto &state) {
-        return func(state);
-    });
+    if (auto *scrollback = terminalEmulator.getScrollback())
+    {
+        scrollback->lock([&] (ScrollbackStore &store) {
+            store.markViewed();
+            func(store);
+        });
+        return true;
+    }
+    return false;
 }
 
 } // namespace tvterm
@@ -4,6 +4,7 @@
 #include <tvterm/pty.h>
 #include <tvterm/array.h>
 #include <tvterm/mutex.h>
+#include <tvterm/scrollback.h>
 #include <vector>
 
 #define Uses_TDrawSurface
@@ -87,6 +88,10 @@ struct TerminalState
 
     bool titleChanged {false};
     GrowArray title;
+
+    // Whether the client handles the mouse wheel by itself (e.g. because it
+    // enabled mouse reporting or uses the alternate screen).
+    bool wheelCaptured {false};
 };
 
 enum class TerminalEventType
@@ -96,6 +101,8 @@ enum class TerminalEventType
     ClientDataRead,
     ViewportResize,
     FocusChange,
+    Paste,
+    VisibilityChange,
 };
 
 struct MouseEvent
@@ -120,6 +127,36 @@ struct FocusChangeEvent
     bool focusEnabled;
 };
 
+struct VisibilityChangeEvent
+{
+    // The bounding rectangle of the part of the terminal screen which can be
+    // seen by the user, in cells: empty if the terminal is hidden, and the
+    // whole screen if it is fully exposed. The TerminalEmulator may leave the
+    // cells outside of it out of the TerminalSurface, as long as it draws
+    // them once they become visible.
+    int left, top, right, bottom;
+
+    bool visible() const noexcept
+    {
+        return left < right && top < bottom;
+    }
+};
+
+struct PasteEvent
+{
+    // Text pasted by the user.
+    //
+    // When sent to a TerminalController, 'data' must have been allocated with
+    // 'new[]', and the controller takes ownership of it. The controller passes
+    // the text on to the TerminalEmulator a chunk at a time, as fast as the
+    // client consumes it. The first chunk has 'begins' set and the last one
+    // has 'ends' set.
+    char *data;
+    size_t size;
+    bool begins;
+    bool ends;
+};
+
 struct TerminalEvent
 {
     TerminalEventType type;
@@ -130,6 +167,8 @@ struct TerminalEvent
         ClientDataReadEvent clientDataRead;
         ViewportResizeEvent viewportResize;
         FocusChangeEvent focusChange;
+        PasteEvent paste;
+        VisibilityChangeEvent visibilityChange;
     };
 };
 
@@ -141,8 +180,18 @@ public:
 
     virtual void handleEvent(const TerminalEvent &event) noexcept = 0;
     virtual void updateState(TerminalState &state) noexcept = 0;
+
+    // Returns the lines scrolled off the top of the screen, or null if they
+    // are not kept. The store may be accessed from other threads, so it must
+    // be locked, and only for short periods of time.
+    virtual ScrollbackStore *getScrollback() noexcept;
 };
 
+inline ScrollbackStore *TerminalEmulator::getScrollback() noexcept
+{
+    return nullptr;
+}
+
 class Writer
 {
 public:
@@ -5,24 +5,79 @@
 #define Uses_TGroup
 #include <tvision/tv.h>
 
+#include <tvterm/termemu.h>
+#include <tvterm/scrollfind.h>
+#include <limits.h>
+#include <string>
+#include <vector>
+
 struct MouseEventType;
 
 namespace tvterm
 {
 
 class TerminalController;
-class TerminalSurface;
-struct TerminalState;
 struct TVTermConstants;
 
 class TerminalView : public TView
 {
     const TVTermConstants &consts;
     bool ownerBufferChanged {false};
+    bool wheelCaptured {false};
+
+    // While scrolling back, the view shows the scrollback starting at row
+    // 'scrollRow' of the logical line which begins at 'scrollLine', followed
+    // by the top of the terminal screen. Logical lines are wrapped at the
+    // width of the view as they are drawn, so that resizing the view does not
+    // require looking at the scrollback. Only the visible lines are drawn,
+    // into 'scrollbackSurface'. 'rowLines' holds the logical line drawn in
+    // each of its rows.
+    bool scrolling {false};
+    bool scrollingEnded {false};
+    size_t scrollLine {0};
+    size_t scrollRow {0};
+    TerminalSurface scrollbackSurface;
+    std::vector<size_t> rowLines;
+    std::vector<TScreenCell> wrappedCells;
+
+    // While finding, the view scrolls back as above, with a find bar in its
+    // last row. The occurrences of 'findText' in the visible lines are
+    // highlighted, and the lines of the scrollback which contain it can be
+    // visited one by one, starting with the most recent. 'findLine' is the
+    // one being visited, if any.
+    bool finding {false};
+    bool findJumpPending {false};
+    std::string findText;
+    size_t findLine {SIZE_MAX};
+    ScrollbackFinder finder;
 
+    // The part of the view which was last reported to the TerminalController
+    // as visible.
+    TRect visibleArea {0, 0, INT_MAX, INT_MAX};
+
+    bool checkUpdates() noexcept;
+    void updateVisibility() noexcept;
+    void removeFromFindingViews() noexcept;
     void handleMouse(ushort what, MouseEventType mouse) noexcept;
+    void sendPaste(TEvent &ev) noexcept;
+    bool handleScrollKey(const KeyDownEvent &keyDown) noexcept;
+    bool handleScrollWheel(const MouseEventType &mouse) noexcept;
+    void scrollBack(int lines) noexcept;
+    void clampScrollPosition(ScrollbackStore &store) noexcept;
+    void moveScrollPosition(ScrollbackStore &store, int rows) noexcept;
+    void setScrollPosition(ScrollbackStore &store, size_t id) noexcept;
+    void endScrolling() noexcept;
+    void startFinding() noexcept;
+    bool handleFindKey(const KeyDownEvent &keyDown) noexcept;
+    void updateFind() noexcept;
+    void findNext(bool older) noexcept;
+    void scrollToLine(size_t id) noexcept;
+    void endFinding() noexcept;
+    int highlightMatches(int rows, size_t currentLine) noexcept;
+    void drawFindBar() noexcept;
     void updateCursor(TerminalState &state) noexcept;
     void updateDisplay(TerminalSurface &surface) noexcept;
+    bool drawScrollback(TerminalState &state) noexcept;
     bool canReuseOwnerBuffer() noexcept;
 
 public:
@@ -35,6 +90,23 @@ public:
                   const TVTermConstants &consts ) noexcept;
     ~TerminalView();
 
+    // Redraws the views whose terminal has been updated. This only looks at
+    // the terminals which have been updated, so it is cheap to invoke
+    // periodically (e.g. from 'TApplication::idle()'). It replaces
+    // broadcasting 'cmCheckTerminalUpdates', which requires looking at every
+    // view. Returns whether any view was drawn. Main thread only.
+    static bool drawUpdated() noexcept;
+    // Tells the TerminalControllers which part of their view can be seen, so
+    // that the cells which cannot be seen are not converted. Views already
+    // do this when they are drawn, but they may become covered without being
+    // drawn, so this should be invoked after the views are moved, resized or
+    // reordered. Main thread only.
+    static void updateVisibilities() noexcept;
+
+    // Opens the find bar with 'text' and shows the scrollback line with the
+    // given id.
+    void showFoundLine(TStringView text, size_t line) noexcept;
+
     void changeBounds(const TRect& bounds) override;
     void setState(ushort aState, bool enable) override;
     void handleEvent(TEvent &ev) override;
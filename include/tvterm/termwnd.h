@@ -12,6 +12,7 @@ namespace tvterm
 
 class TerminalView;
 class TerminalController;
+class ScrollbackStore;
 struct TerminalState;
 struct TVTermConstants;
 struct TerminalUpdatedMsg;
@@ -22,6 +23,7 @@ class BasicTerminalWindow : public TWindow
     TerminalView *view {nullptr};
     size_t titleCapacity {0};
     GrowArray termTitle;
+    bool notReading {false};
 
     void checkChanges(TerminalUpdatedMsg &) noexcept;
     void resizeTitle(size_t);
@@ -42,12 +44,20 @@ public:
                          const TVTermConstants &consts ) noexcept;
 
     void shutDown() override;
+    void close() override;
     const char *getTitle(short) override;
 
     void handleEvent(TEvent &ev) override;
     void setState(ushort aState, Boolean enable) override;
     ushort execute() override;
 
+    // Returns the terminal's scrollback, or null if it has none. It remains
+    // valid as long as 'this'.
+    ScrollbackStore *getScrollback() noexcept;
+    // Shows the scrollback line with the given id, which contains 'text', in
+    // the terminal view, as when finding text.
+    void showFoundLine(TStringView text, size_t line) noexcept;
+
     static TRect viewBounds(const TRect &windowBounds);
     static TPoint viewSize(const TRect &windowBounds);
 };
@@ -2,45 +2,49 @@
 #define TVTERM_VTERMEMU_H
 
 #include <tvterm/termemu.h>
-#include <utility>
-#include <memory>
+#include <tvterm/scrollback.h>
 
 #include <vterm.h>
+#include <limits.h>
 
 namespace tvterm
 {
 
 class VTermEmulatorFactory final : public TerminalEmulatorFactory
 {
+    const char *scrollbackDir;
+
 public:
 
+    // If 'aScrollbackDir' is not null, the emulator keeps its scrollback in a
+    // ScrollbackArchive in that directory, restoring the lines already there.
+    // If the archive cannot be opened, the scrollback is kept in memory.
+    VTermEmulatorFactory(const char *aScrollbackDir = nullptr) noexcept;
+
     TerminalEmulator &create(TPoint size, Writer &clientDataWriter) noexcept override;
     TSpan<const EnvironmentVar> getCustomEnvironment() noexcept override;
 
 };
 
+inline VTermEmulatorFactory::VTermEmulatorFactory(const char *aScrollbackDir) noexcept :
+    scrollbackDir(aScrollbackDir)
+{
+}
+
 class VTermEmulator final : public TerminalEmulator
 {
 public:
 
-    VTermEmulator(TPoint size, Writer &aClientDataWriter) noexcept;
+    VTermEmulator( TPoint size, Writer &aClientDataWriter,
+                   const char *scrollbackDir = nullptr ) noexcept;
     ~VTermEmulator();
 
     void handleEvent(const TerminalEvent &event) noexcept override;
     void updateState(TerminalState &state) noexcept override;
+    ScrollbackStore *getScrollback() noexcept override;
 
 private:
 
-    struct LineStack
-    {
-        enum { maxSize = 10000 };
-
-        std::vector<std::pair<std::unique_ptr<const VTermScreenCell[]>, size_t>> stack;
-        void push(size_t cols, const VTermScreenCell *cells);
-        bool pop(const VTermEmulator &vterm, size_t cols, VTermScreenCell *cells);
-        TSpan<const VTermScreenCell> top() const;
-    };
-
     struct LocalState
     {
         bool cursorChanged {false};
@@ -55,20 +59,38 @@ private:
         bool altScreenEnabled {false};
     };
 
+    // A rectangle move which has been applied to the VTermScreen but not
+    // yet to the TerminalSurface.
+    struct RectMove
+    {
+        VTermRect dest, src;
+    };
+
+    enum { maxPendingMoves = 32 };
+
     struct VTerm *vt;
     struct VTermState *vtState;
     struct VTermScreen *vtScreen;
     Writer &clientDataWriter;
     std::vector<TerminalSurface::RowDamage> damageByRow;
+    std::vector<RectMove> pendingMoves;
     GrowArray strFragBuf;
-    LineStack linestack;
+    ScrollbackStore scrollback;
+    // Buffers used when converting lines for the ScrollbackStore.
+    std::vector<ScrollbackSpan> scrollbackSpans;
+    GrowArray scrollbackText;
     LocalState localState;
+    // Whether the last chunk of pasted text ended in a carriage return.
+    bool pasteAfterCR {false};
+    // Only this part of the screen is drawn into the TerminalSurface.
+    VisibilityChangeEvent visibleArea {0, 0, INT_MAX, INT_MAX};
 
     static const VTermScreenCallbacks callbacks;
 
     TPoint getSize() noexcept;
     void setSize(TPoint size) noexcept;
     void drawDamagedArea(TerminalSurface &surface) noexcept;
+    void applyPendingMoves(TerminalSurface &surface) noexcept;
 
     void writeOutput(const char *data, size_t size);
     int damage(VTermRect rect);
@@ -83,12 +105,6 @@ private:
     VTermScreenCell getDefaultCell() const;
 };
 
-inline TSpan<const VTermScreenCell> VTermEmulator::LineStack::top() const
-{
-    auto &pair = stack.back();
-    return {pair.first.get(), pair.second};
-}
-
 } // namespace tvterm
 
 #endif // TVTERM_VTERMEMU_H
@@ -0,0 +1,119 @@
+#ifndef TVTERM_BYTERING_H
+#define TVTERM_BYTERING_H
+
+#include <stdlib.h>
+
+#include <tvision/tv.h>
+
+#include <atomic>
+
+namespace tvterm
+{
+
+// A lock-free ring buffer of bytes with a single producer and a single
+// consumer, which may run in different threads.
+//
+// Data is written and read in place: the producer gets a contiguous region
+// of free space, fills it and then commits it, and the consumer gets a
+// contiguous region of data, processes it and then consumes it.
+
+class ByteRing
+{
+    // The positions grow indefinitely and are wrapped around when indexing
+    // the buffer. Each of them is written by only one of the sides, and they
+    // are kept in different cache lines so that the sides do not slow each
+    // other down.
+    std::atomic<size_t> head {0}; // Written by the consumer.
+    char headPadding[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> tail {0}; // Written by the producer.
+    char tailPadding[64 - sizeof(std::atomic<size_t>)];
+
+    char *buffer;
+    size_t mask;
+
+public:
+
+    // The capacity gets rounded up to a power of two.
+    ByteRing(size_t minCapacity) noexcept;
+    ~ByteRing();
+
+    ByteRing(const ByteRing &) = delete;
+    ByteRing &operator=(const ByteRing &) = delete;
+
+    size_t capacity() const noexcept;
+
+    // Producer side.
+
+    // Returns the largest contiguous region of free space. May be empty if the
+    // ring is full.
+    TSpan<char> writable() noexcept;
+    // Makes the first 'size' bytes of the region returned by 'writable'
+    // available to the consumer.
+    void commit(size_t size) noexcept;
+
+    // Consumer side.
+
+    // Returns the number of bytes available for reading.
+    size_t readableSize() noexcept;
+    // Returns the largest contiguous region of data. May be empty.
+    TSpan<const char> readable() noexcept;
+    // Releases the first 'size' bytes of the region returned by 'readable'.
+    void consume(size_t size) noexcept;
+};
+
+inline ByteRing::ByteRing(size_t minCapacity) noexcept
+{
+    size_t capacity = 4096;
+    while (capacity < minCapacity)
+        capacity *= 2;
+    buffer = (char *) malloc(capacity);
+    if (!buffer)
+        abort();
+    mask = capacity - 1;
+}
+
+inline ByteRing::~ByteRing()
+{
+    free(buffer);
+}
+
+inline size_t ByteRing::capacity() const noexcept
+{
+    return mask + 1;
+}
+
+inline TSpan<char> ByteRing::writable() noexcept
+{
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t h = head.load(std::memory_order_acquire);
+    size_t offset = t & mask;
+    size_t freeSpace = capacity() - (t - h);
+    return {&buffer[offset], ::min(freeSpace, capacity() - offset)};
+}
+
+inline void ByteRing::commit(size_t size) noexcept
+{
+    tail.store(tail.load(std::memory_order_relaxed) + size, std::memory_order_release);
+}
+
+inline size_t ByteRing::readableSize() noexcept
+{
+    return tail.load(std::memory_order_acquire) - head.load(std::memory_order_relaxed);
+}
+
+inline TSpan<const char> ByteRing::readable() noexcept
+{
+    size_t h = head.load(std::memory_order_relaxed);
+    size_t t = tail.load(std::memory_order_acquire);
+    size_t offset = h & mask;
+    return {&buffer[offset], ::min(t - h, capacity() - offset)};
+}
+
+inline void ByteRing::consume(size_t size) noexcept
+{
+    head.store(head.load(std::memory_order_relaxed) + size, std::memory_order_release);
+}
+
+} // namespace tvterm
+
+#endif // TVTERM_BYTERING_H
@@ -0,0 +1,42 @@
+#include <tvterm/coalesce.h>
+
+namespace tvterm
+{
+
+const TerminalCoalescingPolicy &TerminalCoalescingPolicy::getDefault() noexcept
+{
+    static AdaptiveCoalescingPolicy policy;
+    return policy;
+}
+
+const char *AdaptiveCoalescingPolicy::getName() const noexcept
+{
+    return "adaptive";
+}
+
+TerminalCoalescingDelays AdaptiveCoalescingPolicy::getDelays(const TerminalCoalescingInput &input) const noexcept
+{
+    using std::chrono::milliseconds;
+    if (!input.visible)
+        // Nobody is looking, but the state must still catch up eventually
+        // (e.g. for the scrollback or when the terminal is uncovered).
+        return {milliseconds(50), milliseconds(250)};
+    if (input.inputRate >= bulkInputRate)
+        // There is no point in converting more frames than can be shown.
+        return input.focused ? TerminalCoalescingDelays {milliseconds(8), milliseconds(16)}
+                             : TerminalCoalescingDelays {milliseconds(16), milliseconds(33)};
+    return input.focused ? TerminalCoalescingDelays {milliseconds(1), milliseconds(8)}
+                         : TerminalCoalescingDelays {milliseconds(5), milliseconds(20)};
+}
+
+const char *FixedCoalescingPolicy::getName() const noexcept
+{
+    return "fixed";
+}
+
+TerminalCoalescingDelays FixedCoalescingPolicy::getDelays(const TerminalCoalescingInput &) const noexcept
+{
+    return delays;
+}
+
+} // namespace tvterm
@@ -0,0 +1,148 @@
+#include "emupool.h"
+
+#include <tvterm/mutex.h>
+
+#include <algorithm>
+#include <deque>
+#include <thread>
+
+namespace tvterm
+{
+
+struct EmulationPool::Worker
+{
+    size_t index;
+    // The owner takes tasks from the back, which are the most recently
+    // scheduled ones and probably still in its cache. Thieves take them from
+    // the front.
+    Mutex<std::deque<std::shared_ptr<EmulationTask>>> tasks;
+};
+
+EmulationPool &EmulationPool::getShared() noexcept
+{
+    static auto &pool = *new EmulationPool(std::max(std::thread::hardware_concurrency(), 1U));
+    return pool;
+}
+
+EmulationPool::EmulationPool(size_t workerCount) noexcept
+{
+    for (size_t i = 0; i < workerCount; ++i)
+    {
+        workers.emplace_back(new Worker);
+        workers.back()->index = i;
+    }
+
+    for (auto &worker : workers)
+        std::thread([this, &worker = *worker] {
+            run(worker);
+        }).detach();
+}
+
+void EmulationPool::schedule(std::shared_ptr<EmulationTask> task) noexcept
+{
+    int state = task->state;
+    while (true)
+    {
+        if (state == EmulationTask::queued || state == EmulationTask::runningAndQueued)
+            return;
+        int newState = state == EmulationTask::idle ? EmulationTask::queued
+                                                    : EmulationTask::runningAndQueued;
+        if (task->state.compare_exchange_weak(state, newState))
+            break;
+    }
+
+    if (state == EmulationTask::idle)
+    {
+        // Distribute new tasks evenly. Workers will steal them anyway if they
+        // become unbalanced.
+        auto &worker = *workers[nextWorker++ % workers.size()];
+        push(worker, std::move(task), false);
+    }
+    // Otherwise, the task will be queued again once it finishes running.
+}
+
+void EmulationPool::push(Worker &worker, std::shared_ptr<EmulationTask> task, bool front) noexcept
+{
+    worker.tasks.lock([&] (auto &tasks) {
+        if (front)
+            tasks.push_front(std::move(task));
+        else
+            tasks.push_back(std::move(task));
+    });
+
+    ++queuedTasks;
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        wake = sleepingWorkers > 0;
+    }
+    if (wake)
+        sleepCondVar.notify_one();
+}
+
+std::shared_ptr<EmulationTask> EmulationPool::pop(Worker &worker) noexcept
+{
+    std::shared_ptr<EmulationTask> task;
+    worker.tasks.lock([&] (auto &tasks) {
+        if (!tasks.empty())
+        {
+            task = std::move(tasks.back());
+            tasks.pop_back();
+        }
+    });
+
+    if (!task)
+    {
+        // Start stealing from the next worker, so that not every thief goes
+        // for the same victim.
+        for (size_t i = 1; !task && i < workers.size(); ++i)
+        {
+            auto &victim = *workers[(worker.index + i) % workers.size()];
+            victim.tasks.lock([&] (auto &tasks) {
+                if (!tasks.empty())
+                {
+                    task = std::move(tasks.front());
+                    tasks.pop_front();
+                }
+            });
+        }
+    }
+
+    if (task)
+        --queuedTasks;
+    return task;
+}
+
+void EmulationPool::run(Worker &worker) noexcept
+{
+    while (true)
+    {
+        auto task = pop(worker);
+        if (!task)
+        {
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            ++sleepingWorkers;
+            // 'queuedTasks' is incremented before checking 'sleepingWorkers',
+            // so we cannot miss a task scheduled after this check.
+            sleepCondVar.wait(lock, [&] {
+                return queuedTasks > 0;
+            });
+            --sleepingWorkers;
+            continue;
+        }
+
+        task->state = EmulationTask::running;
+        task->run();
+
+        int state = EmulationTask::running;
+        if (!task->state.compare_exchange_strong(state, EmulationTask::idle))
+        {
+            // The task was scheduled while it was running. Let the other
+            // tasks in the queue run first.
+            task->state = EmulationTask::queued;
+            push(worker, std::move(task), true);
+        }
+    }
+}
+
+} // namespace tvterm
@@ -0,0 +1,69 @@
+#ifndef TVTERM_EMUPOOL_H
+#define TVTERM_EMUPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace tvterm
+{
+
+class EmulationTask
+{
+public:
+
+    // Invoked from one of the EmulationPool's threads. Never invoked
+    // concurrently for the same task.
+    virtual void run() noexcept = 0;
+
+private:
+
+    friend class EmulationPool;
+
+    enum : int { idle, queued, running, runningAndQueued };
+
+    std::atomic<int> state {idle};
+};
+
+// An EmulationPool runs EmulationTasks on a fixed set of threads, as many as
+// there are cores in the system. Each thread has its own queue of tasks, and
+// threads whose queue is empty steal tasks from the others.
+//
+// A task can be scheduled any number of times, but it runs at most once at a
+// time: scheduling it while it is running causes it to run again afterwards.
+
+class EmulationPool
+{
+public:
+
+    // Returns the process-wide EmulationPool. It is never destroyed.
+    static EmulationPool &getShared() noexcept;
+
+    // Thread-safe. The pool keeps a reference to the task until it has run.
+    void schedule(std::shared_ptr<EmulationTask> task) noexcept;
+
+private:
+
+    struct Worker;
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<size_t> nextWorker {0};
+
+    // Used for putting idle threads to sleep.
+    std::mutex sleepMutex;
+    std::condition_variable sleepCondVar;
+    std::atomic<size_t> queuedTasks {0};
+    size_t sleepingWorkers {0};
+
+    EmulationPool(size_t workerCount) noexcept;
+
+    void push(Worker &worker, std::shared_ptr<EmulationTask> task, bool front) noexcept;
+    std::shared_ptr<EmulationTask> pop(Worker &worker) noexcept;
+    void run(Worker &worker) noexcept;
+};
+
+} // namespace tvterm
+
+#endif // TVTERM_EMUPOOL_H
@@ -0,0 +1,175 @@
+#include "lz.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+
+namespace tvterm
+{
+
+namespace lz
+{
+
+    enum : size_t
+    {
+        hashBits = 12,
+        minMatch = 4,
+        maxOffset = 65535,
+        // The last bytes are always emitted as literals, so that matches can
+        // be compared 4 bytes at a time without going out of bounds.
+        lastLiterals = 5,
+        lengthMask = 15,
+    };
+
+    static inline uint32_t read32(const uint8_t *p) noexcept
+    {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static inline size_t hash(uint32_t v) noexcept
+    {
+        return (v*2654435761U) >> (32 - hashBits);
+    }
+
+    static inline size_t lengthSize(size_t length) noexcept
+    // Number of extra bytes needed to encode 'length'.
+    {
+        return length >= lengthMask ? (length - lengthMask)/255 + 1 : 0;
+    }
+
+    static inline uint8_t *writeLength(uint8_t *out, size_t length) noexcept
+    {
+        if (length >= lengthMask)
+        {
+            length -= lengthMask;
+            for (; length >= 255; length -= 255)
+                *out++ = 255;
+            *out++ = (uint8_t) length;
+        }
+        return out;
+    }
+
+    static inline bool readLength( const uint8_t *&in, const uint8_t *end,
+                                   size_t &length ) noexcept
+    {
+        if (length == lengthMask)
+        {
+            uint8_t b;
+            do {
+                if (in == end)
+                    return false;
+                b = *in++;
+                length += b;
+            } while (b == 255);
+        }
+        return true;
+    }
+
+} // namespace lz
+
+size_t lzCompress(const char *aSrc, size_t size, char *aDst, size_t capacity) noexcept
+{
+    using namespace lz;
+    auto *in = (const uint8_t *) aSrc;
+    auto *out = (uint8_t *) aDst;
+    auto *outEnd = out + capacity;
+    uint32_t table[1 << hashBits] = {};
+
+    size_t anchor = 0;
+    size_t pos = 0;
+    size_t matchLimit = size > lastLiterals + minMatch ? size - lastLiterals : 0;
+    while (pos < matchLimit)
+    {
+        uint32_t seq = read32(&in[pos]);
+        size_t h = hash(seq);
+        size_t candidate = table[h];
+        table[h] = (uint32_t) pos;
+        if ( candidate >= pos || pos - candidate > maxOffset ||
+             read32(&in[candidate]) != seq )
+        {
+            // Skip faster through data which does not compress.
+            pos += 1 + ((pos - anchor) >> 6);
+            continue;
+        }
+
+        size_t length = minMatch;
+        while (pos + length < matchLimit && in[candidate + length] == in[pos + length])
+            ++length;
+
+        size_t literals = pos - anchor;
+        size_t matchLength = length - minMatch;
+        size_t needed = 1 + lengthSize(literals) + literals + 2 + lengthSize(matchLength);
+        if ((size_t) (outEnd - out) < needed)
+            return 0;
+        *out++ = (uint8_t) ((std::min<size_t>(literals, lengthMask) << 4) |
+                            std::min<size_t>(matchLength, lengthMask));
+        out = writeLength(out, literals);
+        memcpy(out, &in[anchor], literals);
+        out += literals;
+        size_t offset = pos - candidate;
+        *out++ = (uint8_t) offset;
+        *out++ = (uint8_t) (offset >> 8);
+        out = writeLength(out, matchLength);
+
+        pos += length;
+        anchor = pos;
+    }
+
+    size_t literals = size - anchor;
+    if ((size_t) (outEnd - out) < 1 + lengthSize(literals) + literals)
+        return 0;
+    *out++ = (uint8_t) (std::min<size_t>(literals, lengthMask) << 4);
+    out = writeLength(out, literals);
+    memcpy(out, &in[anchor], literals);
+    out += literals;
+    return out - (uint8_t *) aDst;
+}
+
+bool lzDecompress(const char *aSrc, size_t srcSize, char *aDst, size_t size) noexcept
+{
+    using namespace lz;
+    auto *in = (const uint8_t *) aSrc;
+    auto *inEnd = in + srcSize;
+    auto *out = (uint8_t *) aDst;
+    auto *outBegin = out;
+    auto *outEnd = out + size;
+
+    while (in < inEnd)
+    {
+        uint8_t token = *in++;
+        size_t literals = token >> 4;
+        if ( !readLength(in, inEnd, literals) ||
+             (size_t) (inEnd - in) < literals || (size_t) (outEnd - out) < literals )
+            return false;
+        memcpy(out, in, literals);
+        in += literals;
+        out += literals;
+        if (in == inEnd)
+            break;
+
+        if (inEnd - in < 2)
+            return false;
+        size_t offset = in[0] | (in[1] << 8);
+        in += 2;
+        size_t length = token & lengthMask;
+        if (!readLength(in, inEnd, length))
+            return false;
+        length += minMatch;
+        if ( offset == 0 || offset > (size_t) (out - outBegin) ||
+             (size_t) (outEnd - out) < length )
+            return false;
+        const uint8_t *match = out - offset;
+        if (offset >= length)
+            memcpy(out, match, length);
+        else
+            // The match overlaps with itself, which repeats a pattern.
+            for (size_t i = 0; i < length; ++i)
+                out[i] = match[i];
+        out += length;
+    }
+    return out == outEnd;
+}
+
+} // namespace tvterm
@@ -0,0 +1,25 @@
+#ifndef TVTERM_LZ_H
+#define TVTERM_LZ_H
+
+#include <stddef.h>
+
+namespace tvterm
+{
+
+// A small LZ77 compressor in the spirit of LZ4: fast rather than thorough,
+// which is what we need for text that is compressed once and rarely read.
+//
+// The compressed data is a sequence of tokens, each made of a run of literal
+// bytes followed by a back-reference of at least 4 bytes into the previous
+// 64 KiB of output. The last token has literals only.
+
+// Returns the compressed size, or 0 if it would exceed 'capacity'.
+size_t lzCompress(const char *src, size_t size, char *dst, size_t capacity) noexcept;
+
+// Returns false if 'src' is not valid or does not decompress into exactly
+// 'size' bytes.
+bool lzDecompress(const char *src, size_t srcSize, char *dst, size_t size) noexcept;
+
+} // namespace tvterm
+
+#endif // TVTERM_LZ_H
@@ -0,0 +1,150 @@
+#ifndef TVTERM_MPSCQUEUE_H
+#define TVTERM_MPSCQUEUE_H
+
+#include <stddef.h>
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace tvterm
+{
+
+// A queue with multiple producers and a single consumer.
+//
+// Items are stored in a fixed-size lock-free ring (Dmitry Vyukov's bounded
+// queue), so that pushing and popping neither allocates memory nor locks a
+// mutex. Should the ring ever be full, items go to an overflow list protected
+// by a mutex until the consumer catches up. Either way, the items pushed by
+// each producer are popped in the same order.
+//
+// 'T' must be trivially copyable.
+
+template <class T, size_t capacity>
+class MpscQueue
+{
+    static_assert((capacity & (capacity - 1)) == 0, "The capacity must be a power of two");
+
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T item;
+    };
+
+    Cell cells[capacity];
+    std::atomic<size_t> tail {0}; // Written by the producers.
+    size_t head {0}; // Only accessed by the consumer.
+
+    std::atomic<bool> overflowed {false};
+    std::mutex overflowMutex;
+    std::vector<T> overflow;
+
+    bool tryPush(const T &item) noexcept;
+    bool tryPop(T &item) noexcept;
+
+public:
+
+    MpscQueue() noexcept;
+
+    MpscQueue(const MpscQueue &) = delete;
+    MpscQueue &operator=(const MpscQueue &) = delete;
+
+    // Thread-safe.
+    void push(const T &item) noexcept;
+
+    // Invokes 'func' with every item in the queue. Only one thread may be
+    // consuming at a time.
+    // * 'func' takes a 'T &' by parameter.
+    template <class Func>
+    void drain(Func &&func) noexcept;
+};
+
+template <class T, size_t capacity>
+inline MpscQueue<T, capacity>::MpscQueue() noexcept
+{
+    for (size_t i = 0; i < capacity; ++i)
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+template <class T, size_t capacity>
+inline bool MpscQueue<T, capacity>::tryPush(const T &item) noexcept
+{
+    size_t pos = tail.load(std::memory_order_relaxed);
+    while (true)
+    {
+        Cell &cell = cells[pos & (capacity - 1)];
+        size_t seq = cell.sequence.load(std::memory_order_acquire);
+        if (seq == pos)
+        {
+            if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                cell.item = item;
+                cell.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if ((ptrdiff_t) (seq - pos) < 0)
+            // The cell has not been consumed yet: the queue is full.
+            return false;
+        else
+            pos = tail.load(std::memory_order_relaxed);
+    }
+}
+
+template <class T, size_t capacity>
+inline bool MpscQueue<T, capacity>::tryPop(T &item) noexcept
+{
+    Cell &cell = cells[head & (capacity - 1)];
+    if (cell.sequence.load(std::memory_order_acquire) != head + 1)
+        // Empty, or a producer has not finished writing the item yet.
+        return false;
+    item = cell.item;
+    cell.sequence.store(head + capacity, std::memory_order_release);
+    ++head;
+    return true;
+}
+
+template <class T, size_t capacity>
+inline void MpscQueue<T, capacity>::push(const T &item) noexcept
+{
+    // Once an item has overflowed, the following ones must overflow too until
+    // the consumer catches up, or they would be popped before it.
+    if (!overflowed.load(std::memory_order_acquire) && tryPush(item))
+        return;
+
+    std::lock_guard<std::mutex> lock(overflowMutex);
+    if (!overflowed.load(std::memory_order_relaxed) && tryPush(item))
+        return;
+    overflow.push_back(item);
+    overflowed.store(true, std::memory_order_release);
+}
+
+template <class T, size_t capacity>
+template <class Func>
+inline void MpscQueue<T, capacity>::drain(Func &&func) noexcept
+{
+    T item;
+    while (tryPop(item))
+        func(item);
+
+    if (overflowed.load(std::memory_order_acquire))
+    {
+        std::vector<T> items;
+        {
+            std::lock_guard<std::mutex> lock(overflowMutex);
+            // Items that made it into the ring before the overflow began are
+            // older, so consume them first.
+            while (tryPop(item))
+                items.push_back(item);
+            items.insert(items.end(), overflow.begin(), overflow.end());
+            overflow.clear();
+            overflowed.store(false, std::memory_order_release);
+        }
+        for (auto &i : items)
+            func(i);
+    }
+}
+
+} // namespace tvterm
+
+#endif // TVTERM_MPSCQUEUE_H
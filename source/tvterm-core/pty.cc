@@ -8,6 +8,7 @@
 #include <unistd.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 #include <sys/wait.h>
 #include <termios.h>
@@ -70,6 +71,8 @@ bool createPty( PtyDescriptor &ptyDescriptor, TPoint size,
         delete[] str;
         return false;
     }
+    // Writes must not block when the client stops reading its input.
+    fcntl(masterFd, F_SETFL, fcntl(masterFd, F_GETFL) | O_NONBLOCK);
     ptyDescriptor = {masterFd, clientPid};
     return true;
 }
@@ -77,43 +80,51 @@ bool createPty( PtyDescriptor &ptyDescriptor, TPoint size,
 bool PtyMaster::readFromClient(TSpan<char> data, size_t &bytesRead) noexcept
 {
     bytesRead = 0;
-    if (data.size() > 1)
+    if (data.size() > 0)
     {
-        ssize_t r = read(d.masterFd, &data[0], 1);
+        // The descriptor is non-blocking, so wait for data to be available
+        // and then take as much of it as fits at once.
+        ssize_t r;
+        do
+        {
+            struct pollfd pfd {d.masterFd, POLLIN, 0};
+            if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+                return false;
+            r = read(d.masterFd, &data[0], data.size());
+        } while (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR));
         if (r < 0)
             return false;
-        else if (r > 0)
-        {
-            bytesRead += r;
-            int availableBytes = 0;
-            if ( ioctl(d.masterFd, FIONREAD, &availableBytes) != -1 &&
-                 availableBytes > 0 )
-            {
-                size_t bytesToRead = min(availableBytes, data.size() - 1);
-                r = read(d.masterFd, &data[1], bytesToRead);
-                if (r < 0)
-                    return false;
-                bytesRead += r;
-            }
-        }
+        bytesRead = r;
     }
     return true;
 }
 
-bool PtyMaster::writeToClient(TSpan<const char> data) noexcept
+bool PtyMaster::writeToClient(TSpan<const char> data, size_t &bytesWritten) noexcept
 {
-    size_t written = 0;
-    while (written < data.size())
+    bytesWritten = 0;
+    while (bytesWritten < data.size())
     {
-        size_t bytesToWrite = data.size() - written;
-        ssize_t r = write(d.masterFd, &data[written], bytesToWrite);
+        size_t bytesToWrite = data.size() - bytesWritten;
+        ssize_t r = write(d.masterFd, &data[bytesWritten], bytesToWrite);
         if (r < 0)
-            return false;
-        written += r;
+        {
+            if (errno == EINTR)
+                continue;
+            // The client is not consuming its input fast enough.
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        bytesWritten += r;
     }
     return true;
 }
 
+void PtyMaster::waitUntilWritable(int timeoutMs) noexcept
+{
+    struct pollfd pfd {d.masterFd, POLLOUT, 0};
+    int rr = poll(&pfd, 1, timeoutMs);
+    (void) rr;
+}
+
 void PtyMaster::resizeClient(TPoint size) noexcept
 {
     struct winsize w = {};
@@ -456,7 +467,7 @@ bool PtyMaster::readFromClient(TSpan<char> data, size_t &bytesRead) noexcept
     if (processIsNotRunning(d.hClientProcess))
         return false;
 
-    if (data.size() > 1)
+    if (data.size() > 0)
     {
         DWORD r;
         if (!ReadFile(d.hMasterRead, &data[0], 1, &r, nullptr))
@@ -465,7 +476,8 @@ bool PtyMaster::readFromClient(TSpan<char> data, size_t &bytesRead) noexcept
         {
             bytesRead += r;
             DWORD availableBytes = 0;
-            if ( PeekNamedPipe(d.hMasterRead, nullptr, 0, nullptr, &availableBytes, nullptr)  &&
+            if ( data.size() > 1 &&
+                 PeekNamedPipe(d.hMasterRead, nullptr, 0, nullptr, &availableBytes, nullptr)  &&
                  availableBytes > 0 )
             {
                 DWORD bytesToRead = min(availableBytes, data.size() - 1);
@@ -478,23 +490,28 @@ bool PtyMaster::readFromClient(TSpan<char> data, size_t &bytesRead) noexcept
     return true;
 }
 
-bool PtyMaster::writeToClient(TSpan<const char> data) noexcept
+bool PtyMaster::writeToClient(TSpan<const char> data, size_t &bytesWritten) noexcept
 {
+    bytesWritten = 0;
     if (processIsNotRunning(d.hClientProcess))
         return false;
 
-    size_t written = 0;
-    while (written < data.size())
+    // Pipes cannot be written into without blocking, so write everything.
+    while (bytesWritten < data.size())
     {
-        DWORD bytesToWrite = data.size() - written;
+        DWORD bytesToWrite = data.size() - bytesWritten;
         DWORD r;
-        if (!WriteFile(d.hMasterWrite, &data[written], bytesToWrite, &r, nullptr))
+        if (!WriteFile(d.hMasterWrite, &data[bytesWritten], bytesToWrite, &r, nullptr))
             return false;
-        written += r;
+        bytesWritten += r;
     }
     return true;
 }
 
+void PtyMaster::waitUntilWritable(int) noexcept
+{
+}
+
 void PtyMaster::resizeClient(TPoint size) noexcept
 {
     conPty.ResizePseudoConsole(d.hPseudoConsole, toCoord(size));
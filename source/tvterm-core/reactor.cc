@@ -0,0 +1,539 @@
+#include "reactor.h"
+
+#if defined(__linux__)
+
+#include <tvterm/array.h>
+#include <tvterm/mutex.h>
+#include <tvterm/debug.h>
+
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+namespace tvterm
+{
+
+// The EpollReactor consists of a small set of worker threads, each of which
+// has its own epoll instance and an eventfd used for waking it up. Clients
+// are bound to a single worker for their whole lifetime, so that callbacks for
+// the same client never run concurrently.
+
+class EpollReactor final : public IoReactor
+{
+public:
+
+    static EpollReactor *create() noexcept;
+
+    std::shared_ptr<Handle> add(int fd, std::shared_ptr<IoReactorClient> client) noexcept override;
+    void wakeUp(Handle &handle) noexcept override;
+    void setTimeout(Handle &handle, TimePoint timeout) noexcept override;
+    void write(Handle &handle, TSpan<const char> data) noexcept override;
+    size_t getPendingOutput(Handle &handle) noexcept override;
+    std::shared_ptr<IoReactorClient> remove(Handle &handle) noexcept override;
+
+private:
+
+    enum { maxWorkers = 4 };
+    enum { maxEvents = 64, readBufSize = 16384, maxReadsPerEvent = 4 };
+
+    struct Worker;
+
+    struct Slot final : Handle
+    {
+        Worker &worker;
+        int fd;
+        std::shared_ptr<IoReactorClient> client;
+        TimePoint timeout {};
+        bool adopted {false};
+        bool polling {false};
+        bool pollingOutput {false};
+        // Whether 'fd' is in the epoll instance.
+        bool registered {false};
+        std::atomic<bool> wakeUpPending {false};
+
+        // Data which could not be written yet.
+        GrowArray output;
+        size_t outputOffset {0};
+
+        // Data which was read but not taken by the client yet. Meanwhile,
+        // 'fd' is taken out of the epoll instance, which would otherwise keep
+        // reporting EPOLLHUP once the client exits.
+        GrowArray input;
+        size_t inputOffset {0};
+
+        Slot(Worker &aWorker, int aFd, std::shared_ptr<IoReactorClient> aClient) noexcept :
+            worker(aWorker),
+            fd(aFd),
+            client(std::move(aClient))
+        {
+        }
+    };
+
+    struct Worker
+    {
+        int epollFd {-1};
+        int eventFd {-1};
+        std::atomic<size_t> clientCount {0};
+
+        // Only accessed from the worker thread.
+        std::vector<std::shared_ptr<Slot>> slots;
+        char readBuf[readBufSize];
+
+        // Slots which requested to be woken up.
+        Mutex<std::vector<std::shared_ptr<Slot>>> wakeUpList;
+
+        bool init() noexcept;
+        void run() noexcept;
+        int nextTimeoutMs() noexcept;
+        void processWakeUps() noexcept;
+        void processTimeouts() noexcept;
+        void adopt(Slot &slot) noexcept;
+        void readInput(Slot &slot) noexcept;
+        bool giveInput(Slot &slot, TSpan<const char> data) noexcept;
+        void resumeInput(Slot &slot) noexcept;
+        void writeOutput(Slot &slot) noexcept;
+        void stopPolling(Slot &slot) noexcept;
+        void updateEvents(Slot &slot) noexcept;
+        void disconnect(Slot &slot) noexcept;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    EpollReactor() = default;
+    Worker &pickWorker() noexcept;
+};
+
+IoReactor *createEpollReactor() noexcept
+{
+    return EpollReactor::create();
+}
+
+EpollReactor *EpollReactor::create() noexcept
+{
+    size_t workerCount = ::min<size_t>(::max(std::thread::hardware_concurrency()/2, 1U), maxWorkers);
+
+    auto &reactor = *new EpollReactor;
+    for (size_t i = 0; i < workerCount; ++i)
+    {
+        std::unique_ptr<Worker> worker {new Worker};
+        if (!worker->init())
+            break;
+        reactor.workers.push_back(std::move(worker));
+    }
+
+    if (reactor.workers.empty())
+    {
+        delete &reactor;
+        return nullptr;
+    }
+
+    for (auto &worker : reactor.workers)
+        std::thread([&worker = *worker] {
+            worker.run();
+        }).detach();
+
+    return &reactor;
+}
+
+bool EpollReactor::Worker::init() noexcept
+{
+    if ((epollFd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+        return false;
+    if ((eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) != -1)
+    {
+        struct epoll_event ev {};
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, eventFd, &ev) != -1)
+            return true;
+        close(eventFd);
+    }
+    close(epollFd);
+    return false;
+}
+
+EpollReactor::Worker &EpollReactor::pickWorker() noexcept
+{
+    Worker *result = workers[0].get();
+    for (auto &worker : workers)
+        if (worker->clientCount < result->clientCount)
+            result = worker.get();
+    return *result;
+}
+
+std::shared_ptr<IoReactor::Handle> EpollReactor::add(int fd, std::shared_ptr<IoReactorClient> client) noexcept
+{
+    int flags = fcntl(fd, F_GETFL);
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+        return nullptr;
+
+    auto &worker = pickWorker();
+    auto slot = std::make_shared<Slot>(worker, fd, std::move(client));
+    ++worker.clientCount;
+    // The worker will start polling the file descriptor once it processes the
+    // wake-up. This ensures that epoll events never reference a slot which
+    // the worker does not know about.
+    wakeUp(*slot);
+    return slot;
+}
+
+void EpollReactor::wakeUp(Handle &handle) noexcept
+{
+    auto &slot = (Slot &) handle;
+    if (!slot.wakeUpPending.exchange(true))
+    {
+        auto &worker = slot.worker;
+        worker.wakeUpList.lock([&] (auto &wakeUpList) {
+            wakeUpList.push_back(std::static_pointer_cast<Slot>(slot.shared_from_this()));
+        });
+        uint64_t one = 1;
+        ssize_t r = ::write(worker.eventFd, &one, sizeof(one));
+        (void) r;
+    }
+}
+
+void EpollReactor::setTimeout(Handle &handle, TimePoint timeout) noexcept
+{
+    auto &slot = (Slot &) handle;
+    slot.timeout = timeout;
+}
+
+void EpollReactor::write(Handle &handle, TSpan<const char> data) noexcept
+{
+    auto &slot = (Slot &) handle;
+    if (slot.polling && data.size() > 0)
+    {
+        slot.output.push(&data[0], data.size());
+        slot.worker.writeOutput(slot);
+    }
+}
+
+size_t EpollReactor::getPendingOutput(Handle &handle) noexcept
+{
+    auto &slot = (Slot &) handle;
+    return slot.output.size() - slot.outputOffset;
+}
+
+std::shared_ptr<IoReactorClient> EpollReactor::remove(Handle &handle) noexcept
+{
+    auto &slot = (Slot &) handle;
+    auto &worker = slot.worker;
+    worker.stopPolling(slot);
+    slot.timeout = TimePoint();
+    --worker.clientCount;
+    // The slot will be erased from 'worker.slots' once the current iteration
+    // is finished.
+    return std::move(slot.client);
+}
+
+void EpollReactor::Worker::run() noexcept
+{
+    struct epoll_event events[maxEvents];
+    while (true)
+    {
+        int n = epoll_wait(epollFd, events, maxEvents, nextTimeoutMs());
+        if (n < 0 && errno != EINTR)
+        {
+            dout << "epoll_wait failed: " << strerror(errno) << std::endl;
+            break;
+        }
+
+        for (int i = 0; i < n; ++i)
+        {
+            if (!events[i].data.ptr)
+                processWakeUps();
+            else
+            {
+                // The slot is kept alive by 'slots' until the end of the
+                // iteration, even if it gets removed in the meantime.
+                auto &slot = *(Slot *) events[i].data.ptr;
+                if (slot.client && (events[i].events & EPOLLOUT))
+                {
+                    writeOutput(slot);
+                    if (slot.client && slot.polling && slot.output.size() == 0)
+                    {
+                        auto client = slot.client;
+                        client->onWakeUp();
+                    }
+                }
+                if (slot.client && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+                    readInput(slot);
+            }
+        }
+
+        processTimeouts();
+
+        for (size_t i = 0; i < slots.size();)
+            if (!slots[i]->client)
+            {
+                slots[i] = std::move(slots.back());
+                slots.pop_back();
+            }
+            else
+                ++i;
+    }
+}
+
+int EpollReactor::Worker::nextTimeoutMs() noexcept
+{
+    TimePoint timeout {};
+    for (auto &slot : slots)
+        if (slot->timeout != TimePoint() && (timeout == TimePoint() || slot->timeout < timeout))
+            timeout = slot->timeout;
+
+    if (timeout == TimePoint())
+        return -1;
+    auto now = Clock::now();
+    if (timeout <= now)
+        return 0;
+    // Round up so that we do not wake up before the timeout.
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(timeout - now).count();
+    return (int) ::min<decltype(us)>((us + 999)/1000, INT_MAX);
+}
+
+void EpollReactor::Worker::processWakeUps() noexcept
+{
+    uint64_t value;
+    while (read(eventFd, &value, sizeof(value)) > 0);
+
+    std::vector<std::shared_ptr<Slot>> pending;
+    wakeUpList.lock([&] (auto &wakeUpList) {
+        pending.swap(wakeUpList);
+    });
+
+    for (auto &slot : pending)
+    {
+        slot->wakeUpPending = false;
+        if (slot->client)
+        {
+            if (!slot->adopted)
+            {
+                slots.push_back(slot);
+                adopt(*slot);
+            }
+            resumeInput(*slot);
+            if (slot->client)
+            {
+                auto client = slot->client;
+                client->onWakeUp();
+            }
+        }
+    }
+}
+
+void EpollReactor::Worker::adopt(Slot &slot) noexcept
+{
+    slot.adopted = true;
+    struct epoll_event ev {};
+    ev.events = EPOLLIN;
+    ev.data.ptr = &slot;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, slot.fd, &ev) != -1)
+        slot.polling = slot.registered = true;
+    else
+    {
+        dout << "epoll_ctl failed: " << strerror(errno) << std::endl;
+        auto client = slot.client;
+        client->onClientDisconnected();
+    }
+}
+
+void EpollReactor::Worker::processTimeouts() noexcept
+{
+    auto now = Clock::now();
+    for (size_t i = 0; i < slots.size(); ++i)
+    {
+        auto &slot = *slots[i];
+        if (slot.client && slot.timeout != TimePoint() && slot.timeout <= now)
+        {
+            slot.timeout = TimePoint();
+            auto client = slot.client;
+            client->onWakeUp();
+        }
+    }
+}
+
+void EpollReactor::Worker::readInput(Slot &slot) noexcept
+{
+    // Do not read forever from a single client, so that other clients bound
+    // to this worker are not starved.
+    for (int i = 0; i < maxReadsPerEvent && slot.polling && slot.input.size() == 0; ++i)
+    {
+        ssize_t r = ::read(slot.fd, readBuf, readBufSize);
+        if (r > 0)
+        {
+            if (!giveInput(slot, {readBuf, (size_t) r}) || (size_t) r < readBufSize)
+                break;
+        }
+        else if (r < 0 && errno == EINTR)
+            continue;
+        else if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        else
+        {
+            // EOF or error (e.g. EIO once the client side has been closed).
+            disconnect(slot);
+            break;
+        }
+    }
+}
+
+bool EpollReactor::Worker::giveInput(Slot &slot, TSpan<const char> data) noexcept
+// Returns whether the client took all of 'data'. Otherwise, the rest is kept
+// in 'slot.input' and the client stops being polled.
+{
+    auto client = slot.client;
+    size_t taken = client->onClientData(data);
+    if (taken < data.size() && slot.polling)
+    {
+        slot.input.push(&data[taken], data.size() - taken);
+        updateEvents(slot);
+        return false;
+    }
+    return true;
+}
+
+void EpollReactor::Worker::resumeInput(Slot &slot) noexcept
+{
+    if (slot.polling && slot.input.size() > 0)
+    {
+        auto client = slot.client;
+        slot.inputOffset += client->onClientData({ slot.input.data() + slot.inputOffset,
+                                                   slot.input.size() - slot.inputOffset });
+        if (slot.polling && slot.inputOffset == slot.input.size())
+        {
+            slot.input.clear();
+            slot.inputOffset = 0;
+            updateEvents(slot);
+        }
+    }
+}
+
+void EpollReactor::Worker::writeOutput(Slot &slot) noexcept
+{
+    while (slot.outputOffset < slot.output.size())
+    {
+        ssize_t r = ::write( slot.fd, slot.output.data() + slot.outputOffset,
+                             slot.output.size() - slot.outputOffset );
+        if (r >= 0)
+            slot.outputOffset += r;
+        else if (errno == EINTR)
+            continue;
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            break;
+        else
+        {
+            disconnect(slot);
+            return;
+        }
+    }
+
+    if (slot.outputOffset == slot.output.size())
+    {
+        slot.output.clear();
+        slot.outputOffset = 0;
+    }
+
+    bool wantOutput = slot.output.size() > 0;
+    if (slot.pollingOutput != wantOutput)
+    {
+        slot.pollingOutput = wantOutput;
+        updateEvents(slot);
+    }
+}
+
+void EpollReactor::Worker::updateEvents(Slot &slot) noexcept
+{
+    if (slot.polling && slot.input.size() > 0)
+    {
+        // Pending output is still written when more is added or when input
+        // is resumed.
+        if (slot.registered)
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, slot.fd, nullptr);
+        slot.registered = false;
+    }
+    else if (slot.polling)
+    {
+        struct epoll_event ev {};
+        ev.events = EPOLLIN | (slot.pollingOutput ? EPOLLOUT : 0);
+        ev.data.ptr = &slot;
+        epoll_ctl(epollFd, slot.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, slot.fd, &ev);
+        slot.registered = true;
+    }
+}
+
+void EpollReactor::Worker::stopPolling(Slot &slot) noexcept
+{
+    if (slot.polling)
+    {
+        slot.polling = false;
+        slot.pollingOutput = false;
+        if (slot.registered)
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, slot.fd, nullptr);
+        slot.registered = false;
+        slot.output = GrowArray();
+        slot.outputOffset = 0;
+        slot.input = GrowArray();
+        slot.inputOffset = 0;
+    }
+}
+
+void EpollReactor::Worker::disconnect(Slot &slot) noexcept
+{
+    if (slot.polling)
+    {
+        // Keep the slot so that the client can still be woken up, but stop
+        // polling the file descriptor, which would otherwise keep reporting
+        // EPOLLHUP.
+        stopPolling(slot);
+        auto client = slot.client;
+        client->onClientDisconnected();
+    }
+}
+
+} // namespace tvterm
+
+#else
+
+namespace tvterm
+{
+
+IoReactor *createEpollReactor() noexcept
+{
+    return nullptr;
+}
+
+} // namespace tvterm
+
+#endif // __linux__
+
+namespace tvterm
+{
+
+IoReactor *IoReactor::getShared(TerminalIoBackend backend) noexcept
+{
+    switch (backend)
+    {
+        case TerminalIoBackend::IoUring:
+        {
+            static IoReactor *uringReactor = createUringReactor();
+            if (uringReactor)
+                return uringReactor;
+            // Fall back to epoll if the kernel lacks the required features.
+        }
+        // fallthrough
+        case TerminalIoBackend::Epoll:
+        {
+            static IoReactor *epollReactor = createEpollReactor();
+            return epollReactor;
+        }
+        default:
+            return nullptr;
+    }
+}
+
+} // namespace tvterm
@@ -0,0 +1,85 @@
+#ifndef TVTERM_REACTOR_H
+#define TVTERM_REACTOR_H
+
+#include <tvterm/termctrl.h>
+#include <chrono>
+#include <memory>
+
+namespace tvterm
+{
+
+class IoReactorClient
+{
+public:
+
+    // These are invoked from the reactor thread the client is bound to, and
+    // never concurrently for the same client.
+
+    // Data has been received from the client. Returns how much of it was
+    // taken. The reactor keeps the rest and stops reading from the client
+    // until 'IoReactor::wakeUp' is invoked, after which it offers the rest
+    // again.
+    virtual size_t onClientData(TSpan<const char> data) noexcept = 0;
+    // The client closed the connection or an I/O error occurred. No more data
+    // will be read from or written to it.
+    virtual void onClientDisconnected() noexcept = 0;
+    // 'IoReactor::wakeUp' was invoked, the timeout has been reached or the
+    // data which could not be written immediately has been written.
+    virtual void onWakeUp() noexcept = 0;
+};
+
+// An IoReactor allows many clients to share a small, fixed set of threads
+// instead of requiring dedicated threads for each of them.
+
+class IoReactor
+{
+public:
+
+    using Clock = std::chrono::steady_clock;
+    using TimePoint = Clock::time_point;
+
+    class Handle : public std::enable_shared_from_this<Handle>
+    {
+    public:
+
+        virtual ~Handle() = default;
+    };
+
+    // Returns a process-wide IoReactor implementing 'backend', or null if
+    // 'backend' is not supported by the system. The returned object is never
+    // destroyed.
+    static IoReactor *getShared(TerminalIoBackend backend) noexcept;
+
+    // Starts polling 'fd', which may be set to non-blocking mode. The client
+    // will be kept alive until 'remove' gets invoked. Callbacks may start being
+    // invoked before this function returns.
+    // Returns null on error.
+    virtual std::shared_ptr<Handle> add(int fd, std::shared_ptr<IoReactorClient> client) noexcept = 0;
+
+    // Causes 'onWakeUp' to be invoked as soon as possible, after offering
+    // again the data not taken by 'onClientData', if any. Thread-safe.
+    virtual void wakeUp(Handle &handle) noexcept = 0;
+
+    // The following may only be invoked from within the client's callbacks.
+
+    // Causes 'onWakeUp' to be invoked once 'timeout' is reached.
+    // 'TimePoint()' means no timeout.
+    virtual void setTimeout(Handle &handle, TimePoint timeout) noexcept = 0;
+    // Writes 'data' to the client without blocking. Whatever cannot be written
+    // immediately is queued and written once the client is ready for it.
+    virtual void write(Handle &handle, TSpan<const char> data) noexcept = 0;
+    // Returns the amount of data passed to 'write' which has not been written
+    // yet. When it drops to zero, 'onWakeUp' is invoked.
+    virtual size_t getPendingOutput(Handle &handle) noexcept = 0;
+    // Stops polling the file descriptor and returns the reference to the
+    // client that was held by the reactor. No more callbacks will be invoked.
+    virtual std::shared_ptr<IoReactorClient> remove(Handle &handle) noexcept = 0;
+};
+
+// These return null if the backend is not supported by the system.
+IoReactor *createEpollReactor() noexcept; // reactor.cc
+IoReactor *createUringReactor() noexcept; // uring.cc
+
+} // namespace tvterm
+
+#endif // TVTERM_REACTOR_H
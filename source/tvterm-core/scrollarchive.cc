@@ -0,0 +1,378 @@
+#include <tvterm/scrollarchive.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+
+#include "util.h"
+#include "scrollline.h"
+
+#if !defined(_WIN32)
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace tvterm
+{
+
+struct ScrollbackArchive::SegmentHeader
+{
+    enum : uint32_t { currentVersion = 2 };
+
+    char magic[8];
+    uint32_t version;
+    // The layout of ScrollbackSpan depends on the build, so segments written
+    // by a different build are not trusted.
+    uint32_t spanSize;
+    uint64_t size;
+    uint64_t firstLine;
+    uint64_t lineCount;
+    // End of the encoded lines.
+    uint64_t dataEnd;
+    uint64_t reserved[2];
+};
+
+static constexpr char segmentMagic[8] = {'T', 'V', 'T', 'S', 'C', 'R', 'L', '1'};
+
+inline ScrollbackArchive::SegmentHeader &ScrollbackArchive::Segment::header() const noexcept
+{
+    return *(SegmentHeader *) data;
+}
+
+inline uint32_t &ScrollbackArchive::Segment::offset(size_t i) const noexcept
+// The offsets are written backwards from the end of the segment.
+{
+    return ((uint32_t *) (data + size))[-1 - (ptrdiff_t) i];
+}
+
+#if !defined(_WIN32)
+
+ScrollbackArchive *ScrollbackArchive::open(const char *aDir) noexcept
+{
+    std::string dir = aDir;
+    mkdir(dir.c_str(), 0700);
+    int lockFd = ::open((dir + "/lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (lockFd == -1)
+        return nullptr;
+    if (flock(lockFd, LOCK_EX | LOCK_NB) != 0)
+    {
+        close(lockFd);
+        return nullptr;
+    }
+    auto *archive = new ScrollbackArchive(std::move(dir), lockFd);
+    if (!archive->load())
+    {
+        delete archive;
+        return nullptr;
+    }
+    return archive;
+}
+
+std::string ScrollbackArchive::createDirectory(const char *baseDir) noexcept
+{
+    mkdir(baseDir, 0700);
+    std::string dir = std::string(baseDir) + "/term-XXXXXX";
+    if (!mkdtemp(&dir[0]))
+        return {};
+    return dir;
+}
+
+std::vector<std::string> ScrollbackArchive::findUnused(const char *baseDir) noexcept
+{
+    struct Entry
+    {
+        time_t mtime;
+        std::string dir;
+    };
+    std::vector<Entry> entries;
+    if (DIR *d = opendir(baseDir))
+    {
+        while (dirent *e = readdir(d))
+        {
+            if (e->d_name[0] == '.')
+                continue;
+            std::string dir = std::string(baseDir) + "/" + e->d_name;
+            int fd = ::open((dir + "/lock").c_str(), O_RDWR | O_CLOEXEC);
+            if (fd == -1)
+                continue;
+            struct stat st;
+            if (flock(fd, LOCK_EX | LOCK_NB) == 0 && stat(dir.c_str(), &st) == 0)
+                entries.push_back({st.st_mtime, std::move(dir)});
+            close(fd);
+        }
+        closedir(d);
+    }
+    std::sort(
+        entries.begin(), entries.end(),
+        [] (const Entry &a, const Entry &b) { return a.mtime < b.mtime; }
+    );
+    std::vector<std::string> dirs;
+    for (auto &entry : entries)
+        dirs.push_back(std::move(entry.dir));
+    return dirs;
+}
+
+ScrollbackArchive::ScrollbackArchive(std::string &&aDir, int aLockFd) noexcept :
+    dir(std::move(aDir)),
+    lockFd(aLockFd)
+{
+}
+
+ScrollbackArchive::~ScrollbackArchive()
+{
+    for (auto &segment : segments)
+    {
+        munmap(segment.data, segment.size);
+        if (removeFiles)
+            unlink(segment.path.c_str());
+    }
+    if (removeFiles)
+    {
+        unlink((dir + "/lock").c_str());
+        rmdir(dir.c_str());
+    }
+    close(lockFd);
+}
+
+bool ScrollbackArchive::isValidSegment(const Segment &segment) noexcept
+{
+    static_assert(sizeof(SegmentHeader) == 64, "");
+    auto &header = segment.header();
+    size_t size = segment.size;
+    return memcmp(header.magic, segmentMagic, sizeof(segmentMagic)) == 0 &&
+           header.version == SegmentHeader::currentVersion &&
+           header.spanSize == sizeof(ScrollbackSpan) &&
+           header.size == size &&
+           sizeof(SegmentHeader) <= header.dataEnd && header.dataEnd <= size &&
+           header.lineCount <= (size - header.dataEnd)/sizeof(uint32_t);
+}
+
+bool ScrollbackArchive::load() noexcept
+// Maps the existing segments. Their lines are not looked at until needed.
+{
+    DIR *d = opendir(dir.c_str());
+    if (!d)
+        return false;
+    std::vector<Segment> found;
+    while (dirent *e = readdir(d))
+    {
+        size_t len = strlen(e->d_name);
+        if (len < 4 || strcmp(&e->d_name[len - 4], ".seg") != 0)
+            continue;
+        Segment segment {nullptr, 0, dir + "/" + e->d_name};
+        int fd = ::open(segment.path.c_str(), O_RDWR | O_CLOEXEC);
+        if (fd == -1)
+            continue;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(SegmentHeader))
+        {
+            segment.size = st.st_size;
+            void *data = mmap(nullptr, segment.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (data != MAP_FAILED)
+            {
+                segment.data = (char *) data;
+                if (isValidSegment(segment))
+                    found.push_back(std::move(segment));
+                else
+                    munmap(data, segment.size);
+            }
+        }
+        close(fd);
+    }
+    closedir(d);
+
+    std::sort(
+        found.begin(), found.end(),
+        [] (const Segment &a, const Segment &b) {
+            return a.header().firstLine < b.header().firstLine;
+        }
+    );
+    // Only keep the most recent run of consecutive lines, and do not keep
+    // empty segments other than the last one.
+    size_t first = found.size();
+    while ( first > 0 &&
+            ( first == found.size() ||
+              ( found[first - 1].header().lineCount > 0 &&
+                found[first - 1].header().firstLine + found[first - 1].header().lineCount ==
+                found[first].header().firstLine ) ) )
+        --first;
+    for (size_t i = 0; i < found.size(); ++i)
+    {
+        if (i < first)
+            removeSegment(found[i]);
+        else
+            segments.push_back(std::move(found[i]));
+    }
+    // A segment is added right before its first line is written, so the last
+    // one is empty if the process died in between. Other than when it is the
+    // only one, the last segment must have lines for 'pop' to work.
+    if (segments.size() > 1 && segments.back().header().lineCount == 0)
+    {
+        removeSegment(segments.back());
+        segments.pop_back();
+    }
+    if (!segments.empty())
+    {
+        lineBegin = segments.front().header().firstLine;
+        lineEnd = segments.back().header().firstLine + segments.back().header().lineCount;
+    }
+    return true;
+}
+
+bool ScrollbackArchive::addSegment(size_t minSize) noexcept
+{
+    enum { pageSize = 4096 };
+    size_t size = minSize + sizeof(SegmentHeader) + sizeof(uint32_t);
+    size = max<size_t>((size + pageSize - 1) & ~(size_t) (pageSize - 1), segmentSize);
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.seg", (unsigned long long) lineEnd);
+    Segment segment {nullptr, size, dir + name};
+
+    int fd = ::open(segment.path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1)
+        return false;
+    void *data = MAP_FAILED;
+    if (ftruncate(fd, size) == 0)
+        data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        unlink(segment.path.c_str());
+        return false;
+    }
+    segment.data = (char *) data;
+
+    auto &header = segment.header();
+    memcpy(header.magic, segmentMagic, sizeof(segmentMagic));
+    header.version = SegmentHeader::currentVersion;
+    header.spanSize = sizeof(ScrollbackSpan);
+    header.size = size;
+    header.firstLine = lineEnd;
+    header.lineCount = 0;
+    header.dataEnd = sizeof(SegmentHeader);
+    segments.push_back(std::move(segment));
+    return true;
+}
+
+void ScrollbackArchive::removeSegment(Segment &segment) noexcept
+{
+    munmap(segment.data, segment.size);
+    unlink(segment.path.c_str());
+}
+
+bool ScrollbackArchive::push( TSpan<const ScrollbackSpan> spans, TStringView text,
+                              bool wrapped ) noexcept
+{
+    size_t size = encodedLineSize(spans, text);
+    auto fits = [&] (const Segment &segment) {
+        auto &header = segment.header();
+        return size + (header.lineCount + 1)*sizeof(uint32_t) <= segment.size - header.dataEnd;
+    };
+    if ((segments.empty() || !fits(segments.back())) && !addSegment(size))
+        return false;
+
+    auto &segment = segments.back();
+    auto &header = segment.header();
+    encodeLine(&segment.data[header.dataEnd], spans, text, wrapped);
+    segment.offset(header.lineCount) = (uint32_t) header.dataEnd;
+    header.dataEnd += size;
+    // The line only becomes visible once it has been completely written.
+    std::atomic_signal_fence(std::memory_order_release);
+    header.lineCount += 1;
+    ++lineEnd;
+    return true;
+}
+
+void ScrollbackArchive::pop() noexcept
+{
+    auto &segment = segments.back();
+    auto &header = segment.header();
+    size_t lineCount = header.lineCount - 1;
+    header.lineCount = lineCount;
+    std::atomic_signal_fence(std::memory_order_release);
+    header.dataEnd = segment.offset(lineCount);
+    --lineEnd;
+    if (lineCount == 0 && segments.size() > 1)
+    {
+        removeSegment(segment);
+        segments.pop_back();
+    }
+}
+
+void ScrollbackArchive::discardBefore(size_t id) noexcept
+{
+    lineBegin = max(lineBegin, min(id, lineEnd));
+    while (segments.size() > 1)
+    {
+        auto &header = segments.front().header();
+        if (header.firstLine + header.lineCount > lineBegin)
+            break;
+        removeSegment(segments.front());
+        segments.pop_front();
+    }
+}
+
+#else
+
+ScrollbackArchive *ScrollbackArchive::open(const char *) noexcept
+{
+    return nullptr;
+}
+
+std::string ScrollbackArchive::createDirectory(const char *) noexcept
+{
+    return {};
+}
+
+std::vector<std::string> ScrollbackArchive::findUnused(const char *) noexcept
+{
+    return {};
+}
+
+ScrollbackArchive::~ScrollbackArchive()
+{
+}
+
+bool ScrollbackArchive::push(TSpan<const ScrollbackSpan>, TStringView, bool) noexcept
+{
+    return false;
+}
+
+void ScrollbackArchive::pop() noexcept
+{
+}
+
+void ScrollbackArchive::discardBefore(size_t) noexcept
+{
+}
+
+#endif // _WIN32
+
+bool ScrollbackArchive::getLine(size_t id, ScrollbackLine &line) const noexcept
+{
+    if (id < lineBegin || id >= lineEnd)
+        return false;
+    auto it = std::upper_bound(
+        segments.begin(), segments.end(), id,
+        [] (size_t lineId, const Segment &segment) {
+            return lineId < segment.header().firstLine;
+        }
+    );
+    auto &segment = *--it;
+    auto &header = segment.header();
+    size_t i = id - header.firstLine;
+    // The files may have been damaged, so do not trust the offsets.
+    size_t begin = segment.offset(i);
+    size_t end = i + 1 < header.lineCount ? segment.offset(i + 1) : header.dataEnd;
+    if ( begin < sizeof(SegmentHeader) || begin > end || end > header.dataEnd ||
+         begin % alignof(ScrollbackSpan) != 0 )
+        return false;
+    return decodeLine(&segment.data[begin], end - begin, line);
+}
+
+} // namespace tvterm
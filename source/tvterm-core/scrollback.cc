@@ -0,0 +1,476 @@
+#define Uses_TText
+#include <tvision/tv.h>
+
+#include <tvterm/scrollback.h>
+#include <tvterm/scrollarchive.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+
+#include "util.h"
+#include "lz.h"
+#include "scrollline.h"
+
+namespace tvterm
+{
+
+static TScreenCell getBlankCell() noexcept
+{
+    TScreenCell blank;
+    ::setChar(blank, ' ');
+    ::setAttr(blank, TColorAttr {TColorDesired {}, TColorDesired {}});
+    return blank;
+}
+
+void drawScrollbackLine(TSpan<TScreenCell> cells, const ScrollbackLine &line) noexcept
+{
+    TScreenCell blank = getBlankCell();
+
+    size_t x = 0;
+    size_t textPos = 0;
+    for (auto &span : line.spans)
+    {
+        TScreenCell cell = blank;
+        ::setAttr(cell, span.attr);
+        for (size_t i = 0; i < span.cells && x < cells.size(); ++i)
+        {
+            // Cells are placed one by one rather than by drawing the whole
+            // text at once, because Turbo Vision may not agree on the width
+            // of some characters.
+            size_t length = 0;
+            for (size_t j = 0; j < span.codepoints; ++j)
+                length += utf8SeqLength(line.text[textPos + length]);
+            TStringView text = line.text.substr(textPos, length);
+            textPos += length;
+
+            if (text.size() == 1 && ' ' <= text[0] && text[0] < '\x7F')
+            {
+                cells[x] = cell;
+                ::setChar(cells[x], text[0]);
+            }
+            else if (text.empty() || TText::drawStr(cells, x, text, 0, span.attr) == 0)
+                cells[x] = cell;
+            if (span.width == 2 && x + 1 < cells.size() && !cells[x].isWide())
+                cells[x + 1] = cell;
+            x += span.width;
+        }
+    }
+    for (; x < cells.size(); ++x)
+        cells[x] = blank;
+}
+
+size_t getScrollbackLineWidth(const ScrollbackLine &line) noexcept
+{
+    size_t width = 0;
+    for (auto &span : line.spans)
+        width += span.cells*span.width;
+    return width;
+}
+
+ScrollbackStore::ScrollbackStore(size_t aMaxLines, ScrollbackBudget *aBudget) noexcept :
+    maxLines(max<size_t>(aMaxLines, 1)),
+    budget(aBudget)
+{
+    if (budget)
+        budget->attach(*this);
+}
+
+ScrollbackStore::~ScrollbackStore()
+{
+    // After this, the spiller will not touch the store anymore.
+    if (budget)
+        budget->detach(*this);
+    for (auto &block : blocks)
+        freeBlock(block);
+}
+
+void ScrollbackStore::push( TSpan<const ScrollbackSpan> spans, TStringView text,
+                            bool wrapped ) noexcept
+{
+    if (archive)
+    {
+        // If the line cannot be written (e.g. the disk is full), it is lost.
+        if (!archive->push(spans, text, wrapped))
+            return;
+    }
+    else
+    {
+        size_t size = encodedLineSize(spans, text);
+        encodeLine(allocateLine(size), spans, text, wrapped);
+    }
+    markTime();
+    ++lineEnd;
+    while (lineEnd - lineBegin > maxLines)
+        discardOldest();
+}
+
+bool ScrollbackStore::getLine(size_t id, ScrollbackLine &line) noexcept
+{
+    if (id < lineBegin || id >= lineEnd)
+        return false;
+    if (archive)
+        return archive->getLine(id, line);
+    auto it = std::upper_bound(
+        blocks.begin(), blocks.end(), id,
+        [] (size_t lineId, const Block &block) { return lineId < block.firstLine; }
+    );
+    auto &block = *--it;
+    if (!block.data && !loadBlock(block))
+        return false;
+    block.lastUsed = tick();
+    size_t i = id - block.firstLine;
+    size_t begin = block.offsets[i];
+    size_t end = i + 1 < block.offsets.size() ? block.offsets[i + 1] : block.used;
+    return decodeLine(&block.data[begin], end - begin, line);
+}
+
+void ScrollbackStore::pop() noexcept
+{
+    if (!timeMarks.empty() && timeMarks.back().line == lineEnd - 1)
+        timeMarks.pop_back();
+    if (archive)
+    {
+        archive->pop();
+        --lineEnd;
+        return;
+    }
+    auto &block = blocks.back();
+    block.used = block.offsets.back();
+    block.offsets.pop_back();
+    --lineEnd;
+    if (lineBegin == lineEnd)
+    {
+        // Start over, so that no memory is kept for discarded lines.
+        for (auto &b : blocks)
+            freeBlock(b);
+        blocks.clear();
+    }
+    else if (block.offsets.empty())
+    {
+        freeBlock(block);
+        blocks.pop_back();
+    }
+}
+
+size_t ScrollbackStore::logicalLineBegin(size_t id) noexcept
+{
+    // Logical lines always begin at a multiple of 'maxLogicalLines', so that
+    // they are split the same way no matter which line we start from.
+    ScrollbackLine line;
+    while ( id > lineBegin && id % maxLogicalLines != 0 &&
+            getLine(id - 1, line) && line.wrapped )
+        --id;
+    return id;
+}
+
+size_t ScrollbackStore::logicalLineEnd(size_t id) noexcept
+{
+    ScrollbackLine line;
+    while ( id + 1 < lineEnd && (id + 1) % maxLogicalLines != 0 &&
+            getLine(id, line) && line.wrapped )
+        ++id;
+    return id + 1;
+}
+
+size_t ScrollbackStore::drawWrapped( size_t begin, size_t end, size_t width,
+                                     std::vector<TScreenCell> &cells ) noexcept
+{
+    TScreenCell blank = getBlankCell();
+    cells.assign(width, blank);
+    size_t rows = 1;
+    size_t x = 0;
+    std::vector<TScreenCell> lineCells;
+    for (size_t id = begin; id < end; ++id)
+    {
+        ScrollbackLine line;
+        if (!getLine(id, line))
+            continue;
+        lineCells.resize(getScrollbackLineWidth(line));
+        drawScrollbackLine({lineCells.data(), lineCells.size()}, line);
+        for (size_t i = 0; i < lineCells.size();)
+        {
+            // Wide characters are moved to the next row rather than split.
+            size_t charWidth = lineCells[i].isWide() && i + 1 < lineCells.size() ? 2 : 1;
+            if (x + charWidth > width && x > 0)
+            {
+                cells.resize(++rows*width, blank);
+                x = 0;
+            }
+            if (charWidth <= width)
+                for (size_t j = 0; j < charWidth; ++j)
+                    cells[(rows - 1)*width + x + j] = lineCells[i + j];
+            x += min(charWidth, width);
+            i += charWidth;
+        }
+    }
+    return rows;
+}
+
+int64_t ScrollbackStore::getLineTime(size_t id) const noexcept
+{
+    auto it = std::upper_bound(
+        timeMarks.begin(), timeMarks.end(), id,
+        [] (size_t lineId, const TimeMark &mark) { return lineId < mark.line; }
+    );
+    if (id >= lineEnd || it == timeMarks.begin())
+        return 0;
+    return (--it)->time;
+}
+
+void ScrollbackStore::markTime() noexcept
+// Pre: invoked before the new line is counted in 'lineEnd'.
+{
+    int64_t now = (int64_t) ::time(nullptr);
+    if (timeMarks.empty() || timeMarks.back().time != now)
+        timeMarks.push_back({lineEnd, now});
+}
+
+void ScrollbackStore::markViewed() noexcept
+{
+    lastViewed.store(tick(), std::memory_order_relaxed);
+}
+
+void ScrollbackStore::useArchive(ScrollbackArchive *aArchive, size_t aMaxLines) noexcept
+{
+    archive.reset(aArchive);
+    maxLines = max<size_t>(aMaxLines, 1);
+    lineBegin = archive->beginLine();
+    lineEnd = archive->endLine();
+    while (lineEnd - lineBegin > maxLines)
+        discardOldest();
+}
+
+void ScrollbackStore::removeArchiveOnClose() noexcept
+{
+    if (archive)
+        archive->removeOnClose();
+}
+
+char *ScrollbackStore::allocateLine(size_t size) noexcept
+{
+    if ( blocks.empty() || hasCopy(blocks.back()) ||
+         blocks.back().capacity - blocks.back().used < size )
+    {
+        // Lines never span several blocks, so a line which is larger than
+        // usual gets a block of its own.
+        size_t capacity = max<size_t>(size, blockSize);
+        char *data = (char *) malloc(capacity);
+        if (!data)
+            abort();
+        Block block {};
+        block.data = data;
+        block.capacity = capacity;
+        block.firstLine = lineEnd;
+        block.lastUsed = tick();
+        blocks.push_back(std::move(block));
+        residentBytes += capacity;
+        if (budget)
+            budget->allocated(capacity);
+    }
+    auto &block = blocks.back();
+    char *p = &block.data[block.used];
+    block.offsets.push_back((uint32_t) block.used);
+    block.used += size;
+    ++block.version;
+    return p;
+}
+
+void ScrollbackStore::discardOldest() noexcept
+// Pre: the store is not empty.
+{
+    ++lineBegin;
+    while (timeMarks.size() > 1 && timeMarks[1].line <= lineBegin)
+        timeMarks.pop_front();
+    if (archive)
+    {
+        archive->discardBefore(lineBegin);
+        return;
+    }
+    auto &block = blocks.front();
+    if (block.firstLine + block.offsets.size() <= lineBegin)
+    {
+        freeBlock(block);
+        blocks.pop_front();
+    }
+}
+
+ScrollbackStore::Block *ScrollbackStore::findBlock(size_t firstLine) noexcept
+{
+    for (auto &block : blocks)
+        if (block.firstLine == firstLine)
+            return &block;
+    return nullptr;
+}
+
+inline bool ScrollbackStore::hasCopy(const Block &block) const noexcept
+{
+    return block.compressed || block.spilled;
+}
+
+bool ScrollbackStore::loadBlock(Block &block) noexcept
+// Pre: the block is not in memory uncompressed, so it has a copy.
+{
+    char *data = (char *) malloc(block.copySize);
+    if (!data)
+        abort();
+    bool ok;
+    if (block.compressed)
+        ok = lzDecompress(block.compressed, block.compressedSize, data, block.copySize);
+    else if (!block.spillCompressed)
+        ok = budget->readSpill(block.spillOffset, data, block.copySize);
+    else
+    {
+        std::unique_ptr<char[]> buf {new char[block.spillSize]};
+        ok = budget->readSpill(block.spillOffset, buf.get(), block.spillSize) &&
+             lzDecompress(buf.get(), block.spillSize, data, block.copySize);
+    }
+    if (!ok)
+    {
+        free(data);
+        return false;
+    }
+    block.data = data;
+    block.capacity = block.copySize;
+    residentBytes += block.capacity;
+    budget->allocated(block.capacity);
+    return true;
+}
+
+void ScrollbackStore::freeBlockData(Block &block) noexcept
+{
+    if (block.data)
+    {
+        free(block.data);
+        block.data = nullptr;
+        residentBytes -= block.capacity;
+        if (budget)
+            budget->released(block.capacity);
+    }
+}
+
+void ScrollbackStore::freeCompressed(Block &block) noexcept
+{
+    if (block.compressed)
+    {
+        free(block.compressed);
+        block.compressed = nullptr;
+        residentBytes -= block.compressedSize;
+        budget->released(block.compressedSize);
+    }
+}
+
+void ScrollbackStore::freeBlock(Block &block) noexcept
+{
+    freeBlockData(block);
+    freeCompressed(block);
+    if (block.spilled)
+    {
+        budget->releaseSpill(block.spillOffset, block.spillSize);
+        block.spilled = false;
+    }
+}
+
+inline uint64_t ScrollbackStore::tick() noexcept
+{
+    return budget ? budget->tick() : 0;
+}
+
+bool ScrollbackStore::takeColdBlock( uint64_t horizon, std::vector<char> &buf,
+                                     BlockVersion &bv ) noexcept
+{
+    // The last block is left alone, since lines are still being added to it.
+    for (size_t i = 0; i + 1 < blocks.size(); ++i)
+    {
+        auto &block = blocks[i];
+        if (block.data && block.lastUsed < horizon)
+        {
+            if (hasCopy(block))
+                freeBlockData(block);
+            else if (!block.incompressible)
+            {
+                buf.assign(block.data, block.data + block.used);
+                bv = {block.firstLine, block.version, block.used};
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void ScrollbackStore::putCompressedBlock( const BlockVersion &bv,
+                                          const char *data, size_t size ) noexcept
+{
+    Block *block = findBlock(bv.firstLine);
+    if (!block || block->version != bv.version || hasCopy(*block) || !block->data)
+        return;
+    if (size == 0)
+    {
+        block->incompressible = true;
+        return;
+    }
+    char *compressed = (char *) malloc(size);
+    if (!compressed)
+        abort();
+    memcpy(compressed, data, size);
+    block->compressed = compressed;
+    block->compressedSize = size;
+    block->copySize = bv.size;
+    residentBytes += size;
+    budget->allocated(size);
+    freeBlockData(*block);
+}
+
+bool ScrollbackStore::takeSpillBlock(std::vector<char> &buf, BlockVersion &bv) noexcept
+{
+    Block *coldest = nullptr;
+    for (size_t i = 0; i + 1 < blocks.size(); ++i)
+    {
+        auto &block = blocks[i];
+        if ( (block.data || block.compressed) &&
+             (!coldest || block.lastUsed < coldest->lastUsed) )
+            coldest = &block;
+    }
+    if (!coldest)
+        return false;
+    auto &block = *coldest;
+    buf.clear();
+    if (block.spilled)
+    {
+        freeBlockData(block);
+        freeCompressed(block);
+    }
+    else
+    {
+        // Write the compressed copy, if there is one.
+        if (block.compressed)
+            buf.assign(block.compressed, block.compressed + block.compressedSize);
+        else
+            buf.assign(block.data, block.data + block.used);
+        bv = {block.firstLine, block.version, block.compressed ? block.copySize : block.used};
+    }
+    return true;
+}
+
+void ScrollbackStore::putSpilledBlock( const BlockVersion &bv, uint64_t offset,
+                                       size_t size ) noexcept
+{
+    Block *block = findBlock(bv.firstLine);
+    bool compressed = block && block->compressed;
+    if ( !block || block->version != bv.version || block->spilled ||
+         size != (compressed ? block->compressedSize : block->used) )
+    {
+        budget->releaseSpill(offset, size);
+        return;
+    }
+    block->spilled = true;
+    block->spillCompressed = compressed;
+    block->spillOffset = offset;
+    block->spillSize = size;
+    block->copySize = bv.size;
+    freeBlockData(*block);
+    freeCompressed(*block);
+}
+
+} // namespace tvterm
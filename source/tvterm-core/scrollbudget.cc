@@ -0,0 +1,423 @@
+#include <tvterm/scrollback.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "lz.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+namespace tvterm
+{
+
+// An unnamed temporary file which is removed when closed.
+//
+// Extents are always appended at the end of the file. On Linux, the disk
+// space of released extents is given back to the filesystem by punching
+// holes. Either way, the file is truncated once no extent is in use.
+
+struct ScrollbackBudget::SpillFile
+{
+    enum { pageSize = 4096 };
+
+#if !defined(_WIN32)
+    int fd {-1};
+#else
+    FILE *file {nullptr};
+#endif
+    uint64_t end {0};
+    size_t extentsInUse {0};
+
+    bool open() noexcept;
+    ~SpillFile();
+
+    bool write(const char *data, size_t size, uint64_t &offset) noexcept;
+    bool read(uint64_t offset, char *data, size_t size) noexcept;
+    void release(uint64_t offset, size_t size) noexcept;
+};
+
+#if !defined(_WIN32)
+
+bool ScrollbackBudget::SpillFile::open() noexcept
+{
+    const char *dir = getenv("TMPDIR");
+    if (!dir || !*dir)
+        dir = "/tmp";
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/tvterm-scrollback-XXXXXX", dir);
+    fd = mkstemp(path);
+    if (fd == -1)
+        return false;
+    unlink(path);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return true;
+}
+
+ScrollbackBudget::SpillFile::~SpillFile()
+{
+    if (fd != -1)
+        close(fd);
+}
+
+bool ScrollbackBudget::SpillFile::write(const char *data, size_t size, uint64_t &offset) noexcept
+{
+    size_t written = 0;
+    while (written < size)
+    {
+        ssize_t r = pwrite(fd, data + written, size - written, end + written);
+        if (r <= 0)
+            return false;
+        written += r;
+    }
+    offset = end;
+    // Page-aligned extents can be released individually.
+    end += (size + pageSize - 1) & ~(size_t) (pageSize - 1);
+    ++extentsInUse;
+    return true;
+}
+
+bool ScrollbackBudget::SpillFile::read(uint64_t offset, char *data, size_t size) noexcept
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t r = pread(fd, data + done, size - done, offset + done);
+        if (r <= 0)
+            return false;
+        done += r;
+    }
+    return true;
+}
+
+void ScrollbackBudget::SpillFile::release(uint64_t offset, size_t size) noexcept
+{
+    if (--extentsInUse == 0)
+    {
+        if (ftruncate(fd, 0) == 0)
+            end = 0;
+    }
+#if defined(FALLOC_FL_PUNCH_HOLE)
+    else
+    {
+        size = (size + pageSize - 1) & ~(size_t) (pageSize - 1);
+        fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, size);
+    }
+#endif
+}
+
+// Returns the percentage of time in the last 10 seconds in which some tasks
+// were stalled waiting for memory, or 0 if not available.
+static double getMemoryPressure() noexcept
+{
+    double avg10 = 0;
+#if defined(__linux__)
+    if (FILE *f = fopen("/proc/pressure/memory", "r"))
+    {
+        if (fscanf(f, "some avg10=%lf", &avg10) != 1)
+            avg10 = 0;
+        fclose(f);
+    }
+#endif
+    return avg10;
+}
+
+#else
+
+bool ScrollbackBudget::SpillFile::open() noexcept
+{
+    file = tmpfile();
+    return file != nullptr;
+}
+
+ScrollbackBudget::SpillFile::~SpillFile()
+{
+    if (file)
+        fclose(file);
+}
+
+bool ScrollbackBudget::SpillFile::write(const char *data, size_t size, uint64_t &offset) noexcept
+{
+    if ( _fseeki64(file, end, SEEK_SET) != 0 ||
+         fwrite(data, 1, size, file) != size )
+        return false;
+    offset = end;
+    end += size;
+    ++extentsInUse;
+    return true;
+}
+
+bool ScrollbackBudget::SpillFile::read(uint64_t offset, char *data, size_t size) noexcept
+{
+    return _fseeki64(file, offset, SEEK_SET) == 0 &&
+           fread(data, 1, size, file) == size;
+}
+
+void ScrollbackBudget::SpillFile::release(uint64_t, size_t) noexcept
+{
+    // The file cannot be truncated through the C library, but its space can
+    // be reused from the beginning.
+    if (--extentsInUse == 0)
+        end = 0;
+}
+
+static double getMemoryPressure() noexcept
+{
+    return 0;
+}
+
+#endif // _WIN32
+
+ScrollbackBudget &ScrollbackBudget::getShared() noexcept
+{
+    static auto &budget = *new ScrollbackBudget;
+    return budget;
+}
+
+ScrollbackBudget::ScrollbackBudget() noexcept = default;
+
+ScrollbackBudget::~ScrollbackBudget() = default;
+
+void ScrollbackBudget::setLimit(size_t bytes) noexcept
+{
+    limit = bytes;
+    effectiveLimit = bytes;
+    wakeUp();
+}
+
+void ScrollbackBudget::attach(ScrollbackStore &store) noexcept
+{
+    {
+        std::lock_guard<std::mutex> lock(storesMutex);
+        stores.push_back(&store);
+    }
+    std::lock_guard<std::mutex> lock(threadMutex);
+    if (!threadStarted)
+    {
+        threadStarted = true;
+        std::thread([this] {
+            run();
+        }).detach();
+    }
+}
+
+void ScrollbackBudget::detach(ScrollbackStore &store) noexcept
+{
+    std::unique_lock<std::mutex> lock(storesMutex);
+    storesCondVar.wait(lock, [&] {
+        return busyStore != &store;
+    });
+    stores.erase(std::find(stores.begin(), stores.end(), &store));
+}
+
+bool ScrollbackBudget::acquireStore(ScrollbackStore &store) noexcept
+// Marks 'store' as being used by the background thread. Returns false if it
+// has been detached already.
+{
+    std::lock_guard<std::mutex> lock(storesMutex);
+    if (std::find(stores.begin(), stores.end(), &store) == stores.end())
+        return false;
+    busyStore = &store;
+    return true;
+}
+
+void ScrollbackBudget::releaseStore() noexcept
+{
+    {
+        std::lock_guard<std::mutex> lock(storesMutex);
+        busyStore = nullptr;
+    }
+    storesCondVar.notify_all();
+}
+
+void ScrollbackBudget::allocated(size_t bytes) noexcept
+{
+    size_t newUsage = (usage += bytes);
+    if (newUsage > effectiveLimit.load(std::memory_order_relaxed))
+        wakeUp();
+}
+
+void ScrollbackBudget::released(size_t bytes) noexcept
+{
+    usage -= bytes;
+}
+
+void ScrollbackBudget::wakeUp() noexcept
+{
+    {
+        std::lock_guard<std::mutex> lock(threadMutex);
+        if (wakeUpRequested)
+            return;
+        wakeUpRequested = true;
+    }
+    threadCondVar.notify_one();
+}
+
+void ScrollbackBudget::run() noexcept
+{
+#if defined(__linux__)
+    // On Linux, the nice value applies to the individual thread.
+    setpriority(PRIO_PROCESS, (id_t) syscall(SYS_gettid), 10);
+#endif
+    // Memory pressure is sampled periodically. Its average over 10 seconds
+    // changes slowly anyway. Blocks are compressed once they have not been
+    // used for at least this long.
+    using Clock = std::chrono::steady_clock;
+    constexpr auto interval = std::chrono::seconds(2);
+    auto lastInterval = Clock::now();
+    uint64_t horizon = 0;
+    uint64_t nextHorizon = clock;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(threadMutex);
+            threadCondVar.wait_for(lock, interval, [&] {
+                return wakeUpRequested;
+            });
+            wakeUpRequested = false;
+        }
+
+        auto now = Clock::now();
+        if (now - lastInterval >= interval)
+        {
+            lastInterval = now;
+            horizon = nextHorizon;
+            nextHorizon = clock;
+
+            double pressure = getMemoryPressure();
+            size_t newLimit = limit;
+            if (pressure >= 20)
+                newLimit /= 4;
+            else if (pressure >= 5)
+                newLimit /= 2;
+            effectiveLimit = newLimit;
+        }
+
+        compressColdBlocks(horizon);
+        if (usage > effectiveLimit)
+            spillColdest();
+    }
+}
+
+void ScrollbackBudget::compressColdBlocks(uint64_t horizon) noexcept
+{
+    // Blocks are compressed without holding any lock, so that neither the
+    // emulator nor the creation of terminals have to wait.
+    std::vector<ScrollbackStore *> snapshot;
+    {
+        std::lock_guard<std::mutex> lock(storesMutex);
+        snapshot = stores;
+    }
+    std::vector<char> buf, out;
+    for (auto *store : snapshot)
+    {
+        if (!acquireStore(*store))
+            continue;
+        ScrollbackStore::BlockVersion bv;
+        while (store->lock([&] (auto &s) { return s.takeColdBlock(horizon, buf, bv); }))
+        {
+            // Only keep the compressed copy if it saves enough memory.
+            out.resize(buf.size() - buf.size()/4);
+            size_t size = lzCompress(buf.data(), buf.size(), out.data(), out.size());
+            store->lock([&] (auto &s) {
+                s.putCompressedBlock(bv, out.data(), size);
+            });
+        }
+        releaseStore();
+    }
+}
+
+void ScrollbackBudget::spillColdest() noexcept
+{
+    // Go a bit below the limit, so that we do not have to run again as soon
+    // as a few more lines are added.
+    size_t target = effectiveLimit - effectiveLimit/8;
+
+    // Least recently viewed first and, among those never viewed, largest
+    // first. The stores may change meanwhile, so take a snapshot.
+    struct Candidate
+    {
+        uint64_t lastViewed;
+        size_t residentBytes;
+        ScrollbackStore *store;
+    };
+    std::vector<Candidate> candidates;
+    {
+        std::lock_guard<std::mutex> lock(storesMutex);
+        candidates.reserve(stores.size());
+        for (auto *store : stores)
+            candidates.push_back({store->lastViewed, store->residentBytes, store});
+    }
+    std::sort(
+        candidates.begin(), candidates.end(),
+        [] (const Candidate &a, const Candidate &b) {
+            if (a.lastViewed != b.lastViewed)
+                return a.lastViewed < b.lastViewed;
+            return a.residentBytes > b.residentBytes;
+        }
+    );
+    // The spill file is written without holding any lock, so that neither the
+    // emulator nor the creation of terminals have to wait for the disk.
+    std::vector<char> buf;
+    for (auto &candidate : candidates)
+    {
+        if (usage <= target)
+            break;
+        auto &store = *candidate.store;
+        if (!acquireStore(store))
+            continue;
+        ScrollbackStore::BlockVersion bv;
+        while ( usage > target &&
+                store.lock([&] (auto &s) { return s.takeSpillBlock(buf, bv); }) )
+        {
+            uint64_t offset;
+            if (buf.empty())
+                continue;
+            if (!writeSpill(buf.data(), buf.size(), offset))
+                break;
+            store.lock([&] (auto &s) {
+                s.putSpilledBlock(bv, offset, buf.size());
+            });
+        }
+        releaseStore();
+    }
+}
+
+bool ScrollbackBudget::writeSpill(const char *data, size_t size, uint64_t &offset) noexcept
+{
+    std::lock_guard<std::mutex> lock(fileMutex);
+    if (!file)
+    {
+        std::unique_ptr<SpillFile> f {new SpillFile};
+        if (!f->open())
+            return false;
+        file = std::move(f);
+    }
+    return file->write(data, size, offset);
+}
+
+bool ScrollbackBudget::readSpill(uint64_t offset, char *data, size_t size) noexcept
+{
+    std::lock_guard<std::mutex> lock(fileMutex);
+    return file && file->read(offset, data, size);
+}
+
+void ScrollbackBudget::releaseSpill(uint64_t offset, size_t size) noexcept
+{
+    std::lock_guard<std::mutex> lock(fileMutex);
+    if (file)
+        file->release(offset, size);
+}
+
+} // namespace tvterm
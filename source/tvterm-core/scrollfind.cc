@@ -0,0 +1,214 @@
+#include <tvterm/scrollfind.h>
+
+#define Uses_TEventQueue
+#include <tvision/tv.h>
+
+#include <algorithm>
+#include <iterator>
+
+#include "simd.h"
+
+namespace tvterm
+{
+
+static bool lineContains( ScrollbackStore &store, size_t id,
+                          TStringView text, bool ignoreCase ) noexcept
+// A line also contains the text if it begins in the line and ends in the next
+// one, because the terminal wrapped the line there.
+{
+    ScrollbackLine line;
+    if (!store.getLine(id, line))
+        return false;
+    if ( findSubstring( line.text.data(), line.text.size(),
+                        text.data(), text.size(), ignoreCase ) < line.text.size() )
+        return true;
+    if (!line.wrapped || text.size() < 2)
+        return false;
+    // Only the bytes around the wrap need to be looked at.
+    size_t tail = min(line.text.size(), text.size() - 1);
+    std::string joined(&line.text[line.text.size() - tail], tail);
+    ScrollbackLine next;
+    if (!store.getLine(id + 1, next))
+        return false;
+    joined.append(next.text.data(), min(next.text.size(), text.size() - 1));
+    return findSubstring( joined.data(), joined.size(),
+                          text.data(), text.size(), ignoreCase ) < joined.size();
+}
+
+ScrollbackFinder::~ScrollbackFinder()
+{
+    cancel();
+}
+
+bool ScrollbackFinder::ignoresCase(TStringView text) noexcept
+{
+    for (char ch : text)
+        if ('A' <= ch && ch <= 'Z')
+            return false;
+    return true;
+}
+
+void ScrollbackFinder::start(ScrollbackStore &store, TStringView aText) noexcept
+{
+    cancel();
+    std::string text(aText.data(), aText.size());
+    std::vector<size_t> candidates;
+    size_t candidatesEnd = 0;
+    {
+        std::lock_guard<std::mutex> lock {mutex};
+        // Any line containing the new text also contains the previous one,
+        // with the same or fewer restrictions on case.
+        if ( results.done && !lastText.empty() &&
+             text.compare(0, lastText.size(), lastText) == 0 )
+        {
+            candidates = std::move(results.lines);
+            candidatesEnd = lastEnd;
+        }
+        results.lines.clear();
+        results.done = text.empty();
+    }
+    changed = true;
+    lastText = text;
+    if (!text.empty())
+    {
+        cancelled = false;
+        thread = std::thread([this, &store, text, candidates, candidatesEnd] () mutable {
+            run(store, std::move(text), std::move(candidates), candidatesEnd);
+        });
+    }
+}
+
+void ScrollbackFinder::cancel() noexcept
+{
+    if (thread.joinable())
+    {
+        cancelled = true;
+        thread.join();
+    }
+}
+
+void ScrollbackFinder::run( ScrollbackStore &store, std::string text,
+                            std::vector<size_t> candidates, size_t candidatesEnd ) noexcept
+// Lines from 'candidatesEnd' onwards are searched in full. Older lines are
+// only searched if they are in 'candidates', which is sorted like the results.
+{
+    bool ignoreCase = ignoresCase(text);
+    std::vector<size_t> found;
+    size_t id = 0;
+    size_t nextCandidate = 0;
+    bool started = false;
+    bool done = false;
+    while (!done && !cancelled)
+    {
+        done = store.lock([&] (ScrollbackStore &s) {
+            if (!started)
+            {
+                started = true;
+                id = s.endLine();
+                lastEnd = id;
+            }
+            size_t begin = s.beginLine();
+            for (size_t n = 0; n < chunkLines; ++n)
+            {
+                if (id > candidatesEnd)
+                    --id;
+                else if (nextCandidate < candidates.size())
+                    id = candidates[nextCandidate++];
+                else
+                    return true;
+                if (id < begin)
+                    return true;
+                if (lineContains(s, id, text, ignoreCase))
+                    found.push_back(id);
+            }
+            return false;
+        });
+        if (!found.empty() || done)
+            publish(found, done);
+    }
+}
+
+void ScrollbackFinder::publish(std::vector<size_t> &found, bool done) noexcept
+{
+    {
+        std::lock_guard<std::mutex> lock {mutex};
+        results.lines.insert(results.lines.end(), found.begin(), found.end());
+        results.done = done;
+    }
+    found.clear();
+    changed = true;
+    TEventQueue::wakeUp();
+}
+
+std::vector<ScrollbackMatch> findInScrollbacks( TSpan<ScrollbackStore *const> stores,
+                                                TStringView text,
+                                                size_t maxMatches ) noexcept
+{
+    enum { maxTextSize = 256 };
+    if (text.empty() || maxMatches == 0)
+        return {};
+    bool ignoreCase = ScrollbackFinder::ignoresCase(text);
+    // Each thread takes the next store which nobody is searching. Only the
+    // most recent 'maxMatches' lines of each store can make it to the
+    // results.
+    std::atomic<size_t> nextStore {0};
+    std::vector<std::vector<ScrollbackMatch>> found(stores.size());
+    auto work = [&] {
+        size_t i;
+        while ((i = nextStore++) < stores.size())
+        {
+            auto &matches = found[i];
+            size_t id = SIZE_MAX;
+            bool done = false;
+            while (!done)
+                done = stores[i]->lock([&] (ScrollbackStore &store) {
+                    size_t begin = store.beginLine();
+                    id = min(id, store.endLine());
+                    for (size_t n = 0; n < ScrollbackFinder::chunkLines; ++n)
+                    {
+                        if (id <= begin || matches.size() == maxMatches)
+                            return true;
+                        --id;
+                        ScrollbackLine line;
+                        if ( lineContains(store, id, text, ignoreCase) &&
+                             store.getLine(id, line) )
+                        {
+                            size_t size = line.text.size();
+                            if (size > maxTextSize)
+                            {
+                                // Do not cut a UTF-8 sequence.
+                                size = maxTextSize;
+                                while (size > 0 && (line.text[size] & 0xC0) == 0x80)
+                                    --size;
+                            }
+                            matches.push_back({ i, id, store.getLineTime(id),
+                                                {line.text.data(), size} });
+                        }
+                    }
+                    return false;
+                });
+        }
+    };
+    size_t threadCount = min<size_t>(max(std::thread::hardware_concurrency(), 1u), stores.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < threadCount; ++i)
+        threads.emplace_back(work);
+    work();
+    for (auto &thread : threads)
+        thread.join();
+
+    std::vector<ScrollbackMatch> matches;
+    for (auto &m : found)
+        std::move(m.begin(), m.end(), std::back_inserter(matches));
+    std::stable_sort(
+        matches.begin(), matches.end(),
+        [] (const ScrollbackMatch &a, const ScrollbackMatch &b) {
+            return a.time > b.time;
+        }
+    );
+    if (matches.size() > maxMatches)
+        matches.resize(maxMatches);
+    return matches;
+}
+
+} // namespace tvterm
@@ -0,0 +1,65 @@
+#ifndef TVTERM_SCROLLLINE_H
+#define TVTERM_SCROLLLINE_H
+
+#include <tvterm/scrollback.h>
+
+#include <string.h>
+
+namespace tvterm
+{
+
+// The encoding of a scrollback line in memory and on disk: a header, the
+// spans and then the text. Encoded lines are padded so that the next one is
+// properly aligned.
+
+struct ScrollbackLineHeader
+{
+    uint32_t spanCount;
+    uint32_t textSize : 31;
+    uint32_t wrapped : 1;
+};
+
+inline size_t encodedLineSize(TSpan<const ScrollbackSpan> spans, TStringView text) noexcept
+{
+    size_t size = sizeof(ScrollbackLineHeader) + spans.size()*sizeof(ScrollbackSpan) + text.size();
+    return (size + alignof(ScrollbackSpan) - 1) & ~(alignof(ScrollbackSpan) - 1);
+}
+
+inline void encodeLine( char *p, TSpan<const ScrollbackSpan> spans,
+                        TStringView text, bool wrapped ) noexcept
+// Pre: 'p' has room for 'encodedLineSize(spans, text)' bytes.
+{
+    size_t spansSize = spans.size()*sizeof(ScrollbackSpan);
+    ScrollbackLineHeader header {(uint32_t) spans.size(), (uint32_t) text.size(), wrapped};
+    memcpy(p, &header, sizeof(header));
+    p += sizeof(header);
+    if (spansSize > 0)
+        memcpy(p, spans.data(), spansSize);
+    p += spansSize;
+    if (text.size() > 0)
+        memcpy(p, text.data(), text.size());
+}
+
+inline bool decodeLine(const char *p, size_t size, ScrollbackLine &line) noexcept
+// Pre: 'p' is aligned like a ScrollbackSpan.
+// Returns false if the line does not fit in 'size' bytes.
+{
+    ScrollbackLineHeader header;
+    if (size < sizeof(header))
+        return false;
+    memcpy(&header, p, sizeof(header));
+    size -= sizeof(header);
+    p += sizeof(header);
+    if ( header.spanCount > size/sizeof(ScrollbackSpan) ||
+         header.textSize > size - header.spanCount*sizeof(ScrollbackSpan) )
+        return false;
+    line.spans = {(const ScrollbackSpan *) p, header.spanCount};
+    p += header.spanCount*sizeof(ScrollbackSpan);
+    line.text = {p, header.textSize};
+    line.wrapped = header.wrapped;
+    return true;
+}
+
+} // namespace tvterm
+
+#endif // TVTERM_SCROLLLINE_H
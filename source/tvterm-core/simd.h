@@ -0,0 +1,168 @@
+#ifndef TVTERM_SIMD_H
+#define TVTERM_SIMD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// The vectorized versions are chosen at compile time, depending on the
+// instruction sets enabled by the compiler flags (e.g. '-mavx2').
+
+#if defined(_MSC_VER)
+#   include <intrin.h>
+#endif
+
+#if defined(__AVX2__)
+#   include <immintrin.h>
+#   define TVTERM_SIMD_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   include <emmintrin.h>
+#   define TVTERM_SIMD_SSE2
+#endif
+
+namespace tvterm
+{
+
+inline bool isPrintableAscii(uint32_t ch) noexcept
+{
+    return ch - 0x20 < 0x7F - 0x20;
+}
+
+// Returns the length of the longest prefix of 'text' consisting only of
+// printable ASCII characters (0x20 to 0x7E).
+inline size_t printableAsciiPrefix(const uint32_t *text, size_t length) noexcept
+{
+    size_t i = 0;
+#if defined(TVTERM_SIMD_AVX2)
+    // Signed comparison is the only one available, so move the range of
+    // interest to the bottom of the signed range.
+    const __m256i bias = _mm256_set1_epi32(INT32_MIN + 0x20);
+    const __m256i limit = _mm256_set1_epi32(INT32_MIN + (0x7F - 0x20));
+    for (; i + 8 <= length; i += 8)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *) &text[i]);
+        __m256i ok = _mm256_cmpgt_epi32(limit, _mm256_sub_epi32(v, bias));
+        if (_mm256_movemask_epi8(ok) != -1)
+            break;
+    }
+#elif defined(TVTERM_SIMD_SSE2)
+    const __m128i bias = _mm_set1_epi32(INT32_MIN + 0x20);
+    const __m128i limit = _mm_set1_epi32(INT32_MIN + (0x7F - 0x20));
+    for (; i + 4 <= length; i += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *) &text[i]);
+        __m128i ok = _mm_cmpgt_epi32(limit, _mm_sub_epi32(v, bias));
+        if (_mm_movemask_epi8(ok) != 0xFFFF)
+            break;
+    }
+#endif
+    // Process the remaining characters, or find which one stopped the
+    // vectorized loop.
+    while (i < length && isPrintableAscii(text[i]))
+        ++i;
+    return i;
+}
+
+inline int countTrailingZeros(uint32_t mask) noexcept
+// Pre: 'mask' is not zero.
+{
+#if defined(_MSC_VER)
+    unsigned long i;
+    _BitScanForward(&i, mask);
+    return (int) i;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+inline bool isAsciiLetter(char ch) noexcept
+{
+    return ('A' <= ch && ch <= 'Z') || ('a' <= ch && ch <= 'z');
+}
+
+inline char foldAsciiCase(char ch) noexcept
+{
+    return 'A' <= ch && ch <= 'Z' ? ch | 0x20 : ch;
+}
+
+inline bool equalBytes(const char *a, const char *b, size_t length, bool ignoreCase) noexcept
+{
+    if (!ignoreCase)
+        return memcmp(a, b, length) == 0;
+    for (size_t i = 0; i < length; ++i)
+        if (foldAsciiCase(a[i]) != foldAsciiCase(b[i]))
+            return false;
+    return true;
+}
+
+// Returns the position of the first occurrence of 'pattern' in 'text', or
+// 'size' if there is none. If 'ignoreCase' is true, ASCII letters match
+// regardless of their case.
+inline size_t findSubstring( const char *text, size_t size,
+                             const char *pattern, size_t patternSize,
+                             bool ignoreCase ) noexcept
+{
+    if (patternSize == 0)
+        return 0;
+    if (patternSize > size)
+        return size;
+    // Candidates are the positions where both the first and the last byte of
+    // the pattern match, which are tested many at a time. Letters are made
+    // lowercase by setting bit 0x20 when ignoring case.
+    char first = pattern[0], last = pattern[patternSize - 1];
+    char firstFold = ignoreCase && isAsciiLetter(first) ? 0x20 : 0;
+    char lastFold = ignoreCase && isAsciiLetter(last) ? 0x20 : 0;
+    first |= firstFold;
+    last |= lastFold;
+    // The bytes between the first and the last one.
+    size_t middle = patternSize > 2 ? patternSize - 2 : 0;
+    size_t end = size - patternSize + 1;
+    size_t i = 0;
+#if defined(TVTERM_SIMD_AVX2)
+    const __m256i vFirst = _mm256_set1_epi8(first), vFirstFold = _mm256_set1_epi8(firstFold);
+    const __m256i vLast = _mm256_set1_epi8(last), vLastFold = _mm256_set1_epi8(lastFold);
+    for (; i + 32 <= end; i += 32)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *) &text[i]);
+        __m256i b = _mm256_loadu_si256((const __m256i *) &text[i + patternSize - 1]);
+        __m256i eq = _mm256_and_si256(
+            _mm256_cmpeq_epi8(_mm256_or_si256(a, vFirstFold), vFirst),
+            _mm256_cmpeq_epi8(_mm256_or_si256(b, vLastFold), vLast)
+        );
+        for (uint32_t mask = (uint32_t) _mm256_movemask_epi8(eq); mask; mask &= mask - 1)
+        {
+            size_t pos = i + countTrailingZeros(mask);
+            if (equalBytes(&text[pos + 1], &pattern[1], middle, ignoreCase))
+                return pos;
+        }
+    }
+#elif defined(TVTERM_SIMD_SSE2)
+    const __m128i vFirst = _mm_set1_epi8(first), vFirstFold = _mm_set1_epi8(firstFold);
+    const __m128i vLast = _mm_set1_epi8(last), vLastFold = _mm_set1_epi8(lastFold);
+    for (; i + 16 <= end; i += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *) &text[i]);
+        __m128i b = _mm_loadu_si128((const __m128i *) &text[i + patternSize - 1]);
+        __m128i eq = _mm_and_si128(
+            _mm_cmpeq_epi8(_mm_or_si128(a, vFirstFold), vFirst),
+            _mm_cmpeq_epi8(_mm_or_si128(b, vLastFold), vLast)
+        );
+        for (uint32_t mask = (uint32_t) _mm_movemask_epi8(eq); mask; mask &= mask - 1)
+        {
+            size_t pos = i + countTrailingZeros(mask);
+            if (equalBytes(&text[pos + 1], &pattern[1], middle, ignoreCase))
+                return pos;
+        }
+    }
+#endif
+    for (; i < end; ++i)
+        if ( (text[i] | firstFold) == first &&
+             (text[i + patternSize - 1] | lastFold) == last &&
+             equalBytes(&text[i + 1], &pattern[1], middle, ignoreCase) )
+            return i;
+    return size;
+}
+
+} // namespace tvterm
+
+#endif // TVTERM_SIMD_H
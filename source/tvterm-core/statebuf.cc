@@ -0,0 +1,122 @@
+#include <tvterm/statebuf.h>
+
+namespace tvterm
+{
+
+static void mergeDamage( std::vector<TerminalSurface::RowDamage> &dst,
+                         const std::vector<TerminalSurface::RowDamage> &src ) noexcept
+{
+    if (dst.size() < src.size())
+        dst.resize(src.size());
+    for (size_t y = 0; y < src.size(); ++y)
+        dst[y] = {
+            min(dst[y].begin, src[y].begin),
+            max(dst[y].end, src[y].end),
+        };
+}
+
+static void copyCells( TerminalSurface &dst, const TerminalSurface &src,
+                       int y, int begin, int end ) noexcept
+// Pre: both surfaces have the same size and 'y' is within bounds.
+{
+    begin = max(begin, 0);
+    end = min(end, src.size.x);
+    if (begin < end)
+        memcpy(&dst.at(y, begin), &src.at(y, begin), (end - begin)*sizeof(TScreenCell));
+}
+
+static void copyText(GrowArray &dst, GrowArray &src) noexcept
+{
+    dst.clear();
+    if (src.size() > 0)
+        dst.push(src.data(), src.size());
+}
+
+void TerminalStateBuffer::beginUpdate() noexcept
+{
+    auto &state = states[back];
+    auto &stale = staleDamage[back];
+    state.cursorChanged = false;
+    state.titleChanged = false;
+    state.title.clear();
+
+    if (lastPublished != none)
+    {
+        // The consumer may be reading the last published frame, but it never
+        // modifies the cells or the cursor position, so we can read them too.
+        auto &last = states[lastPublished];
+        auto &surface = state.surface;
+        if (surface.size != last.surface.size)
+        {
+            surface.resize(last.surface.size);
+            for (int y = 0; y < surface.size.y; ++y)
+                copyCells(surface, last.surface, y, 0, surface.size.x);
+        }
+        else
+            for (int y = 0; y < min<int>(surface.size.y, (int) stale.size()); ++y)
+                copyCells(surface, last.surface, y, stale[y].begin, stale[y].end);
+
+        state.cursorPos = last.cursorPos;
+        state.cursorVisible = last.cursorVisible;
+        state.cursorBlink = last.cursorBlink;
+    }
+
+    stale.clear();
+    state.surface.clearDamage();
+}
+
+void TerminalStateBuffer::endUpdate() noexcept
+{
+    auto &state = states[back];
+    auto &surface = state.surface;
+
+    // The consumer cannot rely on what it drew before if the size changed.
+    if ( lastPublished == none ||
+         surface.size != states[lastPublished].surface.size )
+        for (int y = 0; y < surface.size.y; ++y)
+            surface.addDamageAtRow(y, 0, surface.size.x);
+
+    std::vector<RowDamage> frameDamage(max(surface.size.y, 0));
+    for (size_t y = 0; y < frameDamage.size(); ++y)
+        frameDamage[y] = surface.damageAtRow(y);
+    for (uint8_t i = 0; i < 3; ++i)
+        if (i != back)
+            mergeDamage(staleDamage[i], frameDamage);
+
+    // Include the changes of frames which may not have been picked up.
+    for (size_t y = 0; y < min(carriedDamage.size(), frameDamage.size()); ++y)
+        surface.addDamageAtRow(y, carriedDamage[y].begin, carriedDamage[y].end);
+
+    bool frameCursorChange = state.cursorChanged;
+    state.cursorChanged |= carriedCursorChange;
+
+    bool frameTitleChange = state.titleChanged;
+    if (frameTitleChange)
+        copyText(carriedTitle, state.title);
+    else if (carriedTitleChange)
+    {
+        state.titleChanged = true;
+        copyText(state.title, carriedTitle);
+    }
+
+    uint8_t prev = ready.exchange(back | fresh, std::memory_order_acq_rel);
+    lastPublished = back;
+    back = prev & indexMask;
+
+    if (!(prev & fresh))
+    {
+        // The previous frame was picked up, so the consumer is only missing
+        // the changes in this one.
+        carriedDamage = std::move(frameDamage);
+        carriedCursorChange = frameCursorChange;
+        carriedTitleChange = frameTitleChange;
+    }
+    else
+    {
+        mergeDamage(carriedDamage, frameDamage);
+        carriedCursorChange |= frameCursorChange;
+        carriedTitleChange |= frameTitleChange;
+    }
+}
+
+} // namespace tvterm
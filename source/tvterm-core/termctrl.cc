@@ -1,13 +1,17 @@
 #include <tvterm/termctrl.h>
+#include "reactor.h"
+#include "bytering.h"
+#include "emupool.h"
+#include "mpscqueue.h"
 
 #define Uses_TEventQueue
 #include <tvision/tv.h>
 
 #include <condition_variable>
 #include <chrono>
+#include <deque>
 #include <thread>
 #include <mutex>
-#include <queue>
 
 namespace tvterm
 {
@@ -30,14 +34,51 @@ public:
 // probably to use something like 'select' to coordinate reads and writes in a
 // single thread. But the model required by Windows also works on Unix, so we
 // just use it everywhere.
-
-struct TerminalController::TerminalEventLoop
+//
+// However, two threads per terminal do not scale well when there are many
+// terminals. So, where supported, the TerminalEventLoop can also be driven by
+// a shared IoReactor. In that case, the IoReactor's callbacks only perform
+// I/O, and the emulation (parsing client data, processing events and updating
+// the TerminalState) runs as a task in the shared EmulationPool. This way, the
+// emulation of all terminals is spread over as many threads as there are
+// cores, regardless of how many terminals there are.
+//
+// In both cases, the reader side only drains the client's output into a ring
+// buffer and never locks 'mutex', so that the client is not blocked while the
+// emulator is busy. The emulation side then parses the buffered data in large
+// batches.
+
+struct TerminalController::TerminalEventLoop final : IoReactorClient, EmulationTask
 {
     using Clock = std::chrono::steady_clock;
     using TimePoint = Clock::time_point;
 
-    enum { maxReadTimeMs = 20, readWaitStepMs = 5 };
-    enum { readBufSize = 4096 };
+    // The input rate given to the TerminalCoalescingPolicy is measured over
+    // periods of at least this long.
+    enum { inputRatePeriodMs = 100 };
+    // The first data received from the client within this long after a key
+    // press is given to the main thread without waiting for more data, since
+    // it is most likely the echo of that key.
+    enum { echoWindowMs = 100 };
+    // The ReaderLoop adjusts the size of its reads between these values
+    // depending on how much data the client is sending.
+    enum { minReadSize = 4096, maxReadSize = 65536 };
+    enum { eventQueueSize = 256 };
+    // Input events are held back while the client has more than this many
+    // bytes left to consume, so that the data waiting to be written to it
+    // remains bounded.
+    enum { maxPendingOutput = 65536 };
+    // Pasted text is given to the emulator this many bytes at a time, and
+    // only once the client has consumed most of the previous chunk, so that
+    // pasting a lot of text neither queues it all up nor keeps the client
+    // from sending us data in the meantime.
+    enum { pasteChunkSize = 16384 };
+    // The client is considered not to be reading its input once the data
+    // written to it has not made any progress for this long.
+    enum { notReadingTimeoutMs = 1000 };
+    // How long the WriterLoop waits for the client to take more data before
+    // it goes on processing events.
+    enum { writeRetryMs = 10 };
 
     TerminalController &ctrl;
 
@@ -50,17 +91,41 @@ struct TerminalController::TerminalEventLoop
     bool terminated {false};
 
     // Used for sending events from the main thread to the TerminalEventLoop's
-    // threads. Has its own mutex to avoid blocking the main thread for long.
-    Mutex<std::queue<TerminalEvent>> eventQueue;
+    // threads. Lock-free, so that the main thread never has to wait for them.
+    MpscQueue<TerminalEvent, eventQueueSize> eventQueue;
 
     // Used for waking up the WriterLoop a short time after data was received
-    // by the ReaderLoop thread.
+    // by the ReaderLoop thread, as decided by 'coalescingPolicy'.
     TimePoint currentTimeout {};
     TimePoint maxReadTimeout {};
+    const TerminalCoalescingPolicy &coalescingPolicy;
+    TerminalCoalescingInput coalescingInput {0, false, true};
+    TerminalCoalescingDelays coalescingDelays {};
+    // Data received since 'inputRatePeriodStart'.
+    TimePoint inputRatePeriodStart {};
+    uint64_t inputRatePeriodBytes {0};
+    // Set when a key press is given to the emulator, and cleared once data
+    // is received. 'echoReceived' makes the next 'updateState' not wait.
+    TimePoint echoDeadline {};
+    bool echoReceived {false};
 
     // Used for waking up the WriterLoop thread on demand, e.g. when there are
-    // pending events or when the timeouts change.
+    // pending events or when data has been read. Has its own mutex so that
+    // the ReaderLoop never has to wait for the emulator to be released.
+    std::mutex wakeUpMutex;
     std::condition_variable condVar;
+    bool wakeUpPending {false};
+
+    // Used for passing data from the ReaderLoop to the WriterLoop, which
+    // parses it. When the buffer is full, the ReaderLoop waits on
+    // 'inputCondVar' (with 'wakeUpMutex') until more space is available.
+    ByteRing inputBuffer;
+    std::condition_variable inputCondVar;
+    // Set once the WriterLoop stops consuming data.
+    std::atomic<bool> inputClosed {false};
+    // Set when the IoReactor had more data than fit in 'inputBuffer', so that
+    // the emulation task tells it to offer the rest again.
+    std::atomic<bool> inputPaused {false};
 
     // Used for storing data to be sent to the client.
     GrowArrayWriter clientDataWriter;
@@ -69,19 +134,61 @@ struct TerminalController::TerminalEventLoop
     bool viewportResized {false};
     TPoint viewportSize {};
 
+    // Used for holding back input events (keys, pastes, etc.) while the
+    // client is not consuming the data we write to it. 'pasteOffset' is how
+    // much of the first event has been given to the emulator if it is a
+    // paste.
+    std::deque<TerminalEvent> pendingInput;
+    size_t pasteOffset {0};
+
+    // The amount of data given to the client which it has not consumed yet,
+    // and since when it has made no progress.
+    size_t pendingOutput {0};
+    TimePoint outputStalledSince {};
+
+    // Used when the event loop is driven by an IoReactor instead of its own
+    // threads. These are set only once, while 'mutex' is locked.
+    IoReactor *reactor {nullptr};
+    std::shared_ptr<IoReactor::Handle> reactorHandle;
+    std::weak_ptr<EmulationTask> emulationTask;
+    // The last timeout passed to the IoReactor. Protected by 'mutex'.
+    TimePoint reactorTimeout {};
+
+    TerminalEventLoop(TerminalController &aCtrl, const TerminalControllerOptions &options) noexcept;
+    ~TerminalEventLoop();
+
+    void start(TerminalIoBackend ioBackend) noexcept;
+    void wakeUp() noexcept;
+
     void runWriterLoop() noexcept;
     void runReaderLoop() noexcept;
+    bool waitForInputSpace() noexcept;
+    void parseInputBuffer() noexcept;
+
+    size_t onClientData(TSpan<const char> data) noexcept override;
+    void onClientDisconnected() noexcept override;
+    void onWakeUp() noexcept override;
+    void flushReactor() noexcept;
+    void scheduleEmulation() noexcept;
+    void run() noexcept override;
+
+    void parseClientData(TSpan<const char> data) noexcept;
     void processEvents() noexcept;
+    static bool isMouseMove(const TerminalEvent &event) noexcept;
+    bool processInput() noexcept;
+    void setPendingOutput(size_t size, bool progressed) noexcept;
     void updateState(bool &) noexcept;
-    void updateTimeouts() noexcept;
+    void updateTimeouts(size_t bytesRead) noexcept;
+    void updateInputRate(TimePoint now, size_t bytesRead) noexcept;
 
-    void writePendingData(GrowArray &, bool &) noexcept;
+    bool writePendingData(GrowArray &, size_t &, bool &) noexcept;
     void notifyMainThread() noexcept;
 };
 
 TerminalController *TerminalController::create( TPoint size,
                                                 TerminalEmulatorFactory &terminalEmulatorFactory,
-                                                void (&onError)(const char *) ) noexcept
+                                                void (&onError)(const char *),
+                                                const TerminalControllerOptions &options ) noexcept
 {
     PtyDescriptor ptyDescriptor;
     if ( !createPty( ptyDescriptor, size,
@@ -90,23 +197,21 @@ TerminalController *TerminalController::create( TPoint size,
 
     auto &terminalController = *new TerminalController( size,
                                                         terminalEmulatorFactory,
-                                                        ptyDescriptor );
+                                                        ptyDescriptor,
+                                                        options );
 
     // 'this' will be deleted when:
     // 1. 'shutDown()' is invoked from the main thread.
-    // 2. Both the WriterLoop and ReaderLoop threads exit.
+    // 2. Both the WriterLoop and ReaderLoop threads exit, or the IoReactor
+    //    releases its reference and the client gets disconnected.
+    // 3. It is not in the list of updated controllers.
     auto deleter = [] (TerminalController *ctrl) {
-        delete ctrl;
+        if (!(ctrl->listState.fetch_or(released) & inUpdatedList))
+            delete ctrl;
     };
     terminalController.selfOwningPtr.reset(&terminalController, deleter);
 
-    std::thread([owningPtr = terminalController.selfOwningPtr] {
-        owningPtr->eventLoop.runWriterLoop();
-    }).detach();
-
-    std::thread([owningPtr = terminalController.selfOwningPtr] {
-        owningPtr->eventLoop.runReaderLoop();
-    }).detach();
+    terminalController.eventLoop.start(options.ioBackend);
 
     return &terminalController;
 }
@@ -117,17 +222,61 @@ void TerminalController::shutDown() noexcept
         std::lock_guard<std::mutex> lock(eventLoop.mutex);
         eventLoop.terminated = true;
     }
-    eventLoop.condVar.notify_one();
+    eventLoop.wakeUp();
+    isShutDown = true;
     selfOwningPtr.reset(); // May delete 'this'.
 }
 
+std::atomic<TerminalController *> TerminalController::updatedList {nullptr};
+std::atomic<bool> TerminalController::updatedListUsed {false};
+
+bool TerminalController::addToUpdatedList() noexcept
+// Pre: 'this' has not been released.
+// Returns whether the main thread has to be woken up. If the list was not
+// empty, whoever added the first controller to it woke it up already, and
+// the main thread has not taken the list since then.
+{
+    if (!updatedListUsed)
+        // Nobody takes the list, so controllers would never be deleted.
+        return true;
+    if (!(listState.fetch_or(inUpdatedList) & inUpdatedList))
+    {
+        nextUpdated = updatedList.load(std::memory_order_relaxed);
+        while (!updatedList.compare_exchange_weak(nextUpdated, this))
+            ;
+        return nextUpdated == nullptr;
+    }
+    return false;
+}
+
+TerminalController *TerminalController::takeUpdatedList() noexcept
+{
+    updatedListUsed = true;
+    return updatedList.exchange(nullptr);
+}
+
+bool TerminalController::removeFromUpdatedList() noexcept
+// Pre: 'this' has been taken from the list by 'takeUpdatedList'.
+// Returns whether 'this' is still alive, in which case it may be added to the
+// list again at any time.
+{
+    if (listState.fetch_and(~inUpdatedList) & released)
+    {
+        delete this;
+        return false;
+    }
+    return true;
+}
+
 TerminalController::TerminalController( TPoint size,
                                         TerminalEmulatorFactory &terminalEmulatorFactory,
-                                        PtyDescriptor ptyDescriptor ) noexcept :
+                                        PtyDescriptor ptyDescriptor,
+                                        const TerminalControllerOptions &options ) noexcept :
     ptyMaster(ptyDescriptor),
-    eventLoop(*new TerminalEventLoop {*this}),
+    eventLoop(*new TerminalEventLoop(*this, options)),
     terminalEmulator(terminalEmulatorFactory.create(size, eventLoop.clientDataWriter))
 {
+    coalescingCounters.policy = eventLoop.coalescingPolicy.getName();
 }
 
 TerminalController::~TerminalController()
@@ -138,40 +287,148 @@ TerminalController::~TerminalController()
 
 void TerminalController::sendEvent(const TerminalEvent &event) noexcept
 {
-    eventLoop.eventQueue.lock([&] (auto &eventQueue) {
-        eventQueue.push(event);
+    eventLoop.eventQueue.push(event);
+    eventLoop.wakeUp();
+}
+
+TerminalController::TerminalEventLoop::TerminalEventLoop( TerminalController &aCtrl,
+                                                          const TerminalControllerOptions &options ) noexcept :
+    ctrl(aCtrl),
+    coalescingPolicy( options.coalescingPolicy ? *options.coalescingPolicy
+                                               : TerminalCoalescingPolicy::getDefault() ),
+    inputBuffer(options.inputBufferCapacity)
+{
+}
+
+TerminalController::TerminalEventLoop::~TerminalEventLoop()
+{
+    eventQueue.drain([&] (TerminalEvent &event) {
+        pendingInput.push_back(event);
     });
-    eventLoop.condVar.notify_one();
+    for (auto &event : pendingInput)
+        if (event.type == TerminalEventType::Paste)
+            delete[] event.paste.data;
+}
+
+void TerminalController::TerminalEventLoop::start(TerminalIoBackend ioBackend) noexcept
+{
+#if !defined(_WIN32)
+    if (IoReactor *aReactor = IoReactor::getShared(ioBackend))
+    {
+        // The IoReactor keeps the TerminalController alive until we remove
+        // ourselves from it.
+        std::shared_ptr<IoReactorClient> client(ctrl.selfOwningPtr, this);
+        // Emulation tasks can only be scheduled while something else keeps
+        // the TerminalController alive.
+        emulationTask = std::shared_ptr<EmulationTask>(ctrl.selfOwningPtr, this);
+        // Callbacks may be invoked before 'add' returns. They will wait for
+        // us to release the lock.
+        std::lock_guard<std::mutex> lock(mutex);
+        if ((reactorHandle = aReactor->add(ctrl.ptyMaster.getMasterFd(), std::move(client))))
+        {
+            reactor = aReactor;
+            return;
+        }
+    }
+#else
+    (void) ioBackend;
+#endif
+
+    std::thread([owningPtr = ctrl.selfOwningPtr] {
+        owningPtr->eventLoop.runWriterLoop();
+    }).detach();
+
+    std::thread([owningPtr = ctrl.selfOwningPtr] {
+        owningPtr->eventLoop.runReaderLoop();
+    }).detach();
+}
+
+void TerminalController::TerminalEventLoop::wakeUp() noexcept
+// Pre: 'this->mutex' needs not be locked.
+{
+    if (reactor)
+        scheduleEmulation();
+    else
+    {
+        {
+            std::lock_guard<std::mutex> lock(wakeUpMutex);
+            wakeUpPending = true;
+        }
+        condVar.notify_one();
+    }
 }
 
 void TerminalController::TerminalEventLoop::runWriterLoop() noexcept
 {
+    // Data to be written to the client, of which the first 'outputOffset'
+    // bytes have been written already.
     GrowArray outputBuffer;
+    size_t outputOffset = 0;
+    bool outputProgressed = false;
+    // The timeouts are only modified by this thread.
+    TimePoint timeout {};
+    bool inputPending = false;
     while (true)
     {
-        bool updated = false;
+        if (outputOffset < outputBuffer.size())
         {
-            std::unique_lock<std::mutex> lock(mutex);
-            if (currentTimeout != TimePoint())
-                condVar.wait_until(lock, currentTimeout);
+            // Writes do not block, so wait for the client to be ready for more
+            // data instead. But not for long, so that events and updates
+            // keep being processed if the client does not read its input.
+            ctrl.ptyMaster.waitUntilWritable(writeRetryMs);
+            std::lock_guard<std::mutex> lock(wakeUpMutex);
+            wakeUpPending = false;
+        }
+        else
+        {
+            std::unique_lock<std::mutex> lock(wakeUpMutex);
+            auto isPending = [&] { return wakeUpPending || inputPending; };
+            if (timeout != TimePoint())
+                condVar.wait_until(lock, timeout, isPending);
             else
                 // Waiting until 'TimePoint()' is not always supported,
                 // so use a regular 'wait'.
-                condVar.wait(lock);
+                condVar.wait(lock, isPending);
+            wakeUpPending = false;
+        }
+
+        bool updated = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
 
             if (terminated)
             {
+                // Let the ReaderLoop discard whatever the client still sends.
+                {
+                    std::lock_guard<std::mutex> wakeUpLock(wakeUpMutex);
+                    inputClosed = true;
+                }
+                inputCondVar.notify_one();
                 ctrl.ptyMaster.disconnect();
                 break;
             }
 
+            parseInputBuffer();
+            setPendingOutput(outputBuffer.size() - outputOffset, outputProgressed);
             processEvents();
+            inputPending = processInput();
             updateState(updated);
 
-            outputBuffer = std::move(clientDataWriter.buffer);
+            auto &buffer = clientDataWriter.buffer;
+            if (outputOffset == outputBuffer.size())
+            {
+                outputBuffer = std::move(buffer);
+                outputOffset = 0;
+            }
+            else if (buffer.size() > 0)
+            {
+                outputBuffer.push(buffer.data(), buffer.size());
+                buffer.clear();
+            }
+            timeout = currentTimeout;
         }
 
-        writePendingData(outputBuffer, updated);
+        outputProgressed = writePendingData(outputBuffer, outputOffset, updated);
 
         if (updated)
             notifyMainThread();
@@ -180,95 +437,392 @@ void TerminalController::TerminalEventLoop::runWriterLoop() noexcept
 
 void TerminalController::TerminalEventLoop::runReaderLoop() noexcept
 {
-    static thread_local char inputBuffer alignas(4096) [readBufSize];
+    // Used once the WriterLoop no longer consumes data.
+    char discardBuffer[minReadSize];
+    size_t readSize = minReadSize;
     while (true)
     {
+        TSpan<char> buffer;
+        if (!inputClosed)
+        {
+            buffer = inputBuffer.writable();
+            if (buffer.size() == 0)
+            {
+                if (!waitForInputSpace())
+                    continue;
+                buffer = inputBuffer.writable();
+            }
+            buffer = {buffer.data(), ::min(buffer.size(), readSize)};
+        }
+        else
+            buffer = discardBuffer;
+
         size_t bytesRead;
-        bool readOk = ctrl.ptyMaster.readFromClient(inputBuffer, bytesRead);
+        bool readOk = ctrl.ptyMaster.readFromClient(buffer, bytesRead);
 
         if (!readOk || bytesRead == 0)
         {
             ctrl.disconnected = true;
+            // Let the WriterLoop parse whatever is left in the buffer.
+            wakeUp();
             notifyMainThread();
             break;
         }
 
-        if (terminated)
+        if (buffer.data() == discardBuffer)
             // We are expected to consume all of the client's data, so keep
             // reading while we can.
             continue;
 
-        bool updated = false;
+        inputBuffer.commit(bytesRead);
+        wakeUp();
+
+        // Read more at once while the client keeps us busy, and go back to
+        // smaller reads once it calms down.
+        if (bytesRead == buffer.size() && buffer.size() == readSize)
+            readSize = ::min<size_t>(2*readSize, maxReadSize);
+        else if (bytesRead < readSize/4)
+            readSize = ::max<size_t>(readSize/2, minReadSize);
+    }
+}
+
+bool TerminalController::TerminalEventLoop::waitForInputSpace() noexcept
+// Returns whether there is space available in 'inputBuffer'. Otherwise, the
+// WriterLoop has stopped consuming data.
+{
+    std::unique_lock<std::mutex> lock(wakeUpMutex);
+    inputCondVar.wait(lock, [&] {
+        return inputClosed || inputBuffer.writable().size() > 0;
+    });
+    return !inputClosed;
+}
+
+void TerminalController::TerminalEventLoop::parseInputBuffer() noexcept
+// Pre: 'this->mutex' is locked.
+{
+    // Only parse what is available now. Otherwise, we could be stuck here
+    // for as long as the client keeps sending data.
+    size_t pending = inputBuffer.readableSize();
+    if (pending > 0)
+    {
+        do
         {
-            std::lock_guard<std::mutex> lock(mutex);
+            TSpan<const char> data = inputBuffer.readable();
+            data = {data.data(), ::min(data.size(), pending)};
+            parseClientData(data);
+            inputBuffer.consume(data.size());
+            pending -= data.size();
+        } while (pending > 0);
+
+        // Locking ensures that the ReaderLoop is either waiting already or
+        // will see the new space before it starts waiting.
+        {
+            std::lock_guard<std::mutex> lock(wakeUpMutex);
+        }
+        inputCondVar.notify_one();
+    }
+}
 
-            TerminalEvent event;
-            event.type = TerminalEventType::ClientDataRead;
-            event.clientDataRead = {inputBuffer, bytesRead};
-            ctrl.terminalEmulator.handleEvent(event);
+size_t TerminalController::TerminalEventLoop::onClientData(TSpan<const char> data) noexcept
+{
+    size_t taken = 0;
+    while (taken < data.size())
+    {
+        TSpan<char> buffer = inputBuffer.writable();
+        if (buffer.size() == 0)
+            break;
+        size_t size = ::min(buffer.size(), data.size() - taken);
+        memcpy(buffer.data(), &data[taken], size);
+        inputBuffer.commit(size);
+        taken += size;
+    }
+
+    if (taken < data.size())
+        // The emulation cannot keep up with the client. The reactor will
+        // stop reading from it until the emulation task makes room.
+        inputPaused = true;
+
+    scheduleEmulation();
+    return taken;
+}
+
+void TerminalController::TerminalEventLoop::onClientDisconnected() noexcept
+{
+    ctrl.disconnected = true;
+    notifyMainThread();
+}
 
-            updateTimeouts();
+void TerminalController::TerminalEventLoop::onWakeUp() noexcept
+{
+    std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+    if (!lock.owns_lock())
+    {
+        // The emulation task is running and it will wake us up again if
+        // there is anything to flush. Make sure it also notices if the
+        // timeout has been reached.
+        scheduleEmulation();
+        return;
+    }
 
-            // We also do these in the ReaderLoop thread because locking may be
-            // unfair. In a situation where we continously receive data from the
-            // client, the ReaderLoop thread may be able to acquire the lock
-            // several times before the WriterLoop wakes up.
+    if (terminated)
+    {
+        // Disconnecting may block for a while, so do it in a separate
+        // thread. That thread inherits the reference held by the reactor.
+        std::shared_ptr<TerminalController> owningPtr(reactor->remove(*reactorHandle), &ctrl);
+        std::thread([owningPtr] {
+            owningPtr->ptyMaster.disconnect();
+        }).detach();
+        return;
+    }
+
+    flushReactor();
+
+    if (currentTimeout != TimePoint() && Clock::now() >= currentTimeout)
+        scheduleEmulation();
+}
+
+void TerminalController::TerminalEventLoop::flushReactor() noexcept
+// Pre: 'this->mutex' is locked and 'reactor' is not null.
+{
+    auto &outputBuffer = clientDataWriter.buffer;
+    if (outputBuffer.size() > 0)
+    {
+        // This does not block. If the client gets disconnected, we will be
+        // notified through 'onClientDisconnected'.
+        if (!ctrl.disconnected)
+            reactor->write(*reactorHandle, {outputBuffer.data(), outputBuffer.size()});
+        outputBuffer.clear();
+    }
+    // The reactor wakes us up once it has written everything, but not when it
+    // only writes part of it, so progress is checked whenever we get here.
+    size_t pending = reactor->getPendingOutput(*reactorHandle);
+    setPendingOutput(pending, pending < pendingOutput);
+    if (!pendingInput.empty() && pendingOutput < maxPendingOutput)
+        scheduleEmulation();
+
+    TimePoint timeout = currentTimeout;
+    if (outputStalledSince != TimePoint() && !ctrl.notReading)
+    {
+        // Come back when the client would be considered not to be reading.
+        auto notReadingTime = outputStalledSince + std::chrono::milliseconds(notReadingTimeoutMs);
+        timeout = timeout == TimePoint() ? notReadingTime : ::min(timeout, notReadingTime);
+    }
+    reactor->setTimeout(*reactorHandle, timeout);
+    reactorTimeout = currentTimeout;
+}
+
+void TerminalController::TerminalEventLoop::scheduleEmulation() noexcept
+// Pre: 'this->mutex' needs not be locked.
+{
+    if (auto task = emulationTask.lock())
+        EmulationPool::getShared().schedule(std::move(task));
+}
+
+void TerminalController::TerminalEventLoop::run() noexcept
+// The emulation task, used when the event loop is driven by an IoReactor.
+{
+    bool updated = false;
+    bool needsReactor;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (terminated)
+            // Let the reactor remove us.
+            needsReactor = true;
+        else
+        {
+            parseInputBuffer();
             processEvents();
+            processInput();
             updateState(updated);
+            // Only the reactor can write to the client and wait for timeouts.
+            // It also knows when the client can take more input.
+            needsReactor = clientDataWriter.buffer.size() > 0 ||
+                           currentTimeout != reactorTimeout ||
+                           !pendingInput.empty();
+            // 'inputBuffer' has been drained, so the rest can be taken now.
+            if (inputPaused.exchange(false))
+                needsReactor = true;
         }
-
-        if (updated)
-            notifyMainThread();
-        // Notify the WriterLoop so that it can use the new timeouts and write
-        // any pending data.
-        condVar.notify_one();
     }
+
+    if (needsReactor)
+        reactor->wakeUp(*reactorHandle);
+    if (updated)
+        notifyMainThread();
 }
 
-void TerminalController::TerminalEventLoop::processEvents() noexcept
+void TerminalController::TerminalEventLoop::parseClientData(TSpan<const char> data) noexcept
 // Pre: 'this->mutex' is locked.
 {
-    while (true)
-    {
-        bool hasEvent;
-        TerminalEvent event;
+    TerminalEvent event;
+    event.type = TerminalEventType::ClientDataRead;
+    event.clientDataRead = {data.data(), data.size()};
+    ctrl.terminalEmulator.handleEvent(event);
 
-        eventQueue.lock([&] (auto &eventQueue) {
-            if ((hasEvent = !eventQueue.empty()))
-            {
-                event = eventQueue.front();
-                eventQueue.pop();
-            }
-        });
-
-        if (!hasEvent)
-            break;
+    updateTimeouts(data.size());
+}
 
+void TerminalController::TerminalEventLoop::processEvents() noexcept
+// Pre: 'this->mutex' is locked.
+{
+    auto &counters = ctrl.eventCounters;
+    eventQueue.drain([&] (TerminalEvent &event) {
+        counters.received.fetch_add(1, std::memory_order_relaxed);
+        // Events which are superseded by the next one are merged into it
+        // before reaching the emulator, so that e.g. dragging the mouse
+        // does not cause a write to the client for every single step.
+        auto *last = pendingInput.empty() ? nullptr : &pendingInput.back();
         switch (event.type)
         {
             case TerminalEventType::ViewportResize:
                 // Do not resize the client yet. We will handle this later.
+                if (viewportResized)
+                    counters.resizesCoalesced.fetch_add(1, std::memory_order_relaxed);
                 viewportSize = {event.viewportResize.x, event.viewportResize.y};
                 viewportResized = true;
                 break;
 
-            default:
+            case TerminalEventType::Mouse:
+                if (last && isMouseMove(event) && isMouseMove(*last) &&
+                    last->mouse.mouse.buttons == event.mouse.mouse.buttons &&
+                    last->mouse.mouse.controlKeyState == event.mouse.mouse.controlKeyState )
+                {
+                    *last = event;
+                    counters.mouseMovesCoalesced.fetch_add(1, std::memory_order_relaxed);
+                }
+                else
+                    pendingInput.push_back(event);
+                break;
+
+            case TerminalEventType::VisibilityChange:
+            {
+                // Not held back like input events, since it does not cause
+                // anything to be sent to the client.
+                bool wasVisible = coalescingInput.visible;
+                coalescingInput.visible = event.visibilityChange.visible();
                 ctrl.terminalEmulator.handleEvent(event);
+                if (!wasVisible && coalescingInput.visible && maxReadTimeout != TimePoint())
+                {
+                    // The pending update was given the delays for a hidden
+                    // terminal. Do not make the user wait for them.
+                    auto now = Clock::now();
+                    coalescingDelays = coalescingPolicy.getDelays(coalescingInput);
+                    maxReadTimeout = ::min(maxReadTimeout, now + coalescingDelays.maxWait);
+                    currentTimeout = ::min(currentTimeout, now + coalescingDelays.waitStep);
+                    currentTimeout = ::min(currentTimeout, maxReadTimeout);
+                    std::lock_guard<std::mutex> lock(ctrl.coalescingMutex);
+                    ctrl.coalescingCounters.lastInput = coalescingInput;
+                    ctrl.coalescingCounters.lastDelays = coalescingDelays;
+                }
+                break;
+            }
+
+            case TerminalEventType::FocusChange:
+                coalescingInput.focused = event.focusChange.focusEnabled;
+                if (last && last->type == TerminalEventType::FocusChange)
+                {
+                    *last = event;
+                    counters.focusChangesCoalesced.fetch_add(1, std::memory_order_relaxed);
+                }
+                else
+                    pendingInput.push_back(event);
+                break;
+
+            default:
+                // Given to the emulator by 'processInput'.
+                pendingInput.push_back(event);
                 break;
         }
+    });
+}
+
+inline bool TerminalController::TerminalEventLoop::isMouseMove(const TerminalEvent &event) noexcept
+{
+    return event.type == TerminalEventType::Mouse &&
+           (event.mouse.what == evMouseMove || event.mouse.what == evMouseAuto);
+}
+
+bool TerminalController::TerminalEventLoop::processInput() noexcept
+// Pre: 'this->mutex' is locked.
+// Gives the emulator the pending input events while the client keeps up with
+// its input. Returns whether there are events left.
+{
+    while (!pendingInput.empty())
+    {
+        auto &event = pendingInput.front();
+        size_t backlog = pendingOutput + clientDataWriter.buffer.size();
+        if (event.type != TerminalEventType::Paste)
+        {
+            if (backlog >= maxPendingOutput)
+                break;
+            if (event.type == TerminalEventType::KeyDown)
+                echoDeadline = Clock::now() + std::chrono::milliseconds(echoWindowMs);
+            ctrl.terminalEmulator.handleEvent(event);
+            pendingInput.pop_front();
+        }
+        else
+        {
+            if (backlog >= pasteChunkSize)
+                break;
+            auto &paste = event.paste;
+            size_t size = ::min<size_t>(paste.size - pasteOffset, pasteChunkSize);
+            TerminalEvent chunk;
+            chunk.type = TerminalEventType::Paste;
+            chunk.paste = { &paste.data[pasteOffset], size,
+                            pasteOffset == 0, pasteOffset + size == paste.size };
+            ctrl.terminalEmulator.handleEvent(chunk);
+            pasteOffset += size;
+            if (pasteOffset == paste.size)
+            {
+                delete[] paste.data;
+                pendingInput.pop_front();
+                pasteOffset = 0;
+            }
+        }
+    }
+    return !pendingInput.empty();
+}
+
+void TerminalController::TerminalEventLoop::setPendingOutput(size_t size, bool progressed) noexcept
+// Pre: 'this->mutex' is locked.
+// Records how much of the data written to the client it has not consumed yet
+// and whether it consumed any since the last time, and updates whether the
+// client is considered not to be reading.
+{
+    pendingOutput = size;
+    if (size == 0 || progressed)
+        outputStalledSince = TimePoint();
+    auto now = Clock::now();
+    if (size > 0 && outputStalledSince == TimePoint())
+        outputStalledSince = now;
+    bool notReading = outputStalledSince != TimePoint() &&
+                      now - outputStalledSince >= std::chrono::milliseconds(notReadingTimeoutMs);
+    if (ctrl.notReading != notReading)
+    {
+        ctrl.notReading = notReading;
+        notifyMainThread();
     }
 }
 
 void TerminalController::TerminalEventLoop::updateState(bool &updated) noexcept
 // Pre: 'this->mutex' is locked.
 {
-    if (Clock::now() > currentTimeout)
+    if (echoReceived || Clock::now() > currentTimeout)
     {
+        if (echoReceived || currentTimeout != TimePoint())
+        {
+            std::lock_guard<std::mutex> lock(ctrl.coalescingMutex);
+            auto &counters = ctrl.coalescingCounters;
+            (echoReceived                       ? counters.echoUpdates
+             : currentTimeout == maxReadTimeout ? counters.maxWaitUpdates
+                                                : counters.quietUpdates) += 1;
+        }
+        echoReceived = false;
         updated = true;
         currentTimeout = TimePoint();
         maxReadTimeout = TimePoint();
 
-        ctrl.lockState([&] (auto &state) {
+        ctrl.terminalState.update([&] (auto &state) {
             ctrl.terminalEmulator.updateState(state);
         });
     }
@@ -288,41 +842,93 @@ void TerminalController::TerminalEventLoop::updateState(bool &updated) noexcept
     }
 }
 
-void TerminalController::TerminalEventLoop::updateTimeouts() noexcept
+void TerminalController::TerminalEventLoop::updateTimeouts(size_t bytesRead) noexcept
 // Pre: 'this->mutex' is locked.
 {
-    // When receiving data, we want to flush updates either:
-    // - 'readWaitStepMs' after data was last received.
-    // - 'maxReadTimeMs' after the first time data was received.
     auto now = Clock::now();
+    updateInputRate(now, bytesRead);
+    if (echoDeadline != TimePoint())
+    {
+        // Only the first read is treated as an echo. Whatever comes after it
+        // is coalesced as usual.
+        echoReceived = now < echoDeadline;
+        echoDeadline = TimePoint();
+    }
+    // When receiving data, we want to flush updates either:
+    // - 'waitStep' after data was last received.
+    // - 'maxWait' after the first time data was received.
     if (maxReadTimeout == TimePoint())
-        maxReadTimeout = now + std::chrono::milliseconds(maxReadTimeMs);
+    {
+        // The delays are only chosen once per update, so that the policy
+        // cannot keep postponing it.
+        coalescingDelays = coalescingPolicy.getDelays(coalescingInput);
+        maxReadTimeout = now + coalescingDelays.maxWait;
+        std::lock_guard<std::mutex> lock(ctrl.coalescingMutex);
+        ctrl.coalescingCounters.lastInput = coalescingInput;
+        ctrl.coalescingCounters.lastDelays = coalescingDelays;
+    }
+
+    currentTimeout = ::min(now + coalescingDelays.waitStep, maxReadTimeout);
+}
 
-    currentTimeout = ::min( now + std::chrono::milliseconds(readWaitStepMs),
-                            maxReadTimeout );
+void TerminalController::TerminalEventLoop::updateInputRate(TimePoint now, size_t bytesRead) noexcept
+// Pre: 'this->mutex' is locked.
+{
+    inputRatePeriodBytes += bytesRead;
+    auto elapsed = now - inputRatePeriodStart;
+    if (elapsed >= std::chrono::milliseconds(inputRatePeriodMs))
+    {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+        uint64_t rate = inputRatePeriodBytes*1000000/us;
+        // After a long pause, the data read so far is what matters.
+        if (elapsed >= 4*std::chrono::milliseconds(inputRatePeriodMs))
+            coalescingInput.inputRate = rate;
+        else
+            coalescingInput.inputRate = (coalescingInput.inputRate + rate)/2;
+        inputRatePeriodStart = now;
+        inputRatePeriodBytes = 0;
+    }
 }
 
-void TerminalController::TerminalEventLoop::writePendingData(GrowArray &outputBuffer, bool &updated) noexcept
+bool TerminalController::TerminalEventLoop::writePendingData( GrowArray &outputBuffer,
+                                                              size_t &outputOffset,
+                                                              bool &updated ) noexcept
 // Pre: 'this->mutex' needs not be locked.
+// Writes as much of the data after 'outputOffset' as the client can take.
+// Returns whether any data was consumed.
 {
-    if (outputBuffer.size() > 0)
+    size_t bytesWritten = 0;
+    if (outputOffset < outputBuffer.size())
     {
-        if ( !ctrl.disconnected &&
-             !ctrl.ptyMaster.writeToClient({outputBuffer.data(), outputBuffer.size()}) )
+        TSpan<const char> data {&outputBuffer.data()[outputOffset], outputBuffer.size() - outputOffset};
+        if (!ctrl.disconnected && !ctrl.ptyMaster.writeToClient(data, bytesWritten))
         {
             ctrl.disconnected = true;
             updated = true;
         }
+        // Nobody will read the data anymore.
+        if (ctrl.disconnected)
+            bytesWritten = data.size();
 
-        outputBuffer.clear();
+        outputOffset += bytesWritten;
+        if (outputOffset == outputBuffer.size())
+        {
+            outputBuffer.clear();
+            outputOffset = 0;
+        }
     }
+    return bytesWritten > 0;
 }
 
 void TerminalController::TerminalEventLoop::notifyMainThread() noexcept
 // Pre: 'this->mutex' needs not be locked.
 {
     ctrl.updated = true;
-    TEventQueue::wakeUp();
+    // While the main thread is busy drawing, many controllers may be updated
+    // many times. Waking it up only once avoids redundant iterations of the
+    // event loop.
+    if (ctrl.addToUpdatedList())
+        TEventQueue::wakeUp();
 }
 
 } // namespace tvterm
@@ -4,11 +4,24 @@
 
 #define Uses_TKeys
 #define Uses_TEvent
+#define Uses_TText
 #include <tvision/tv.h>
 
+#include <stdio.h>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+#include "simd.h"
+
 namespace tvterm
 {
 
+// The existing views by controller, and the ones whose finder may have found
+// something. Only accessed from the main thread.
+static std::unordered_map<TerminalController *, TerminalView *> viewsByController;
+static std::vector<TerminalView *> findingViews;
+
 TerminalView::TerminalView( const TRect &bounds, TerminalController &aTermCtrl,
                             const TVTermConstants &aConsts ) noexcept :
     TView(bounds),
@@ -19,13 +32,124 @@ TerminalView::TerminalView( const TRect &bounds, TerminalController &aTermCtrl,
     options |= ofSelectable | ofFirstClick;
     eventMask |= evMouseMove | evMouseAuto | evMouseWheel | evBroadcast;
     showCursor();
+    viewsByController[&termCtrl] = this;
 }
 
 TerminalView::~TerminalView()
 {
+    viewsByController.erase(&termCtrl);
+    removeFromFindingViews();
+    // The finder may be using the scrollback.
+    finder.cancel();
     termCtrl.shutDown();
 }
 
+bool TerminalView::drawUpdated() noexcept
+{
+    bool drawn = false;
+    TerminalController::forEachUpdated([&] (TerminalController &ctrl) {
+        auto it = viewsByController.find(&ctrl);
+        if (it != viewsByController.end())
+            drawn |= it->second->checkUpdates();
+    });
+    for (size_t i = 0; i < findingViews.size(); ++i)
+        if (findingViews[i]->finder.resultsChanged())
+        {
+            findingViews[i]->drawView();
+            drawn = true;
+        }
+    return drawn;
+}
+
+bool TerminalView::checkUpdates() noexcept
+{
+    bool resultsChanged = finding && finder.resultsChanged();
+    if (termCtrl.stateHasBeenUpdated() || resultsChanged)
+    {
+        drawView();
+        return true;
+    }
+    return false;
+}
+
+void TerminalView::removeFromFindingViews() noexcept
+{
+    auto it = std::find(findingViews.begin(), findingViews.end(), this);
+    if (it != findingViews.end())
+        findingViews.erase(it);
+}
+
+void TerminalView::updateVisibilities() noexcept
+{
+    for (auto &entry : viewsByController)
+        entry.second->updateVisibility();
+}
+
+static TRect subtractBounds(TRect r, const TRect &covered) noexcept
+// Returns the bounding rectangle of what remains of 'r' after removing
+// 'covered' from it.
+{
+    TRect common = r;
+    common.intersect(covered);
+    if (common.isEmpty())
+        return r;
+    bool coversRows = common.a.x == r.a.x && common.b.x == r.b.x;
+    bool coversCols = common.a.y == r.a.y && common.b.y == r.b.y;
+    if (coversRows && coversCols)
+        return {0, 0, 0, 0};
+    if (coversRows && common.a.y == r.a.y)
+        r.a.y = common.b.y;
+    else if (coversRows && common.b.y == r.b.y)
+        r.b.y = common.a.y;
+    else if (coversCols && common.a.x == r.a.x)
+        r.a.x = common.b.x;
+    else if (coversCols && common.b.x == r.b.x)
+        r.b.x = common.a.x;
+    return r;
+}
+
+static TRect getVisibleArea(TView &view) noexcept
+// Returns the bounding rectangle of the part of 'view' which is not covered by
+// other views, relative to 'view'. Views which only cover a part of it in the
+// middle are not taken into account.
+{
+    if (!view.getState(sfExposed))
+        return {0, 0, 0, 0};
+    TRect r = view.getExtent();
+    TPoint origin {0, 0};
+    for (TView *p = &view; p->owner; p = p->owner)
+    {
+        // Bring 'r' to the coordinates of the owner and remove the views in
+        // front of 'p'.
+        r.move(p->origin.x, p->origin.y);
+        origin += p->origin;
+        r.intersect(p->owner->getExtent());
+        for (TView *q = p->owner->first(); q && q != p; q = q->nextView())
+            if (q->getState(sfVisible))
+                r = subtractBounds(r, q->getBounds());
+        if (r.isEmpty())
+            return {0, 0, 0, 0};
+    }
+    r.move(-origin.x, -origin.y);
+    return r;
+}
+
+void TerminalView::updateVisibility() noexcept
+{
+    TRect r = getVisibleArea(*this);
+    if (scrolling && !r.isEmpty())
+        // The top of the terminal screen is shown further down.
+        r.a.y = 0;
+    if (r != visibleArea)
+    {
+        visibleArea = r;
+        TerminalEvent termEvent;
+        termEvent.type = TerminalEventType::VisibilityChange;
+        termEvent.visibilityChange = {r.a.x, r.a.y, r.b.x, r.b.y};
+        termCtrl.sendEvent(termEvent);
+    }
+}
+
 void TerminalView::changeBounds(const TRect& bounds)
 {
     setBounds(bounds);
@@ -40,11 +164,15 @@ void TerminalView::changeBounds(const TRect& bounds)
 
 void TerminalView::setState(ushort aState, bool enable)
 {
-    if (aState == sfExposed && enable != getState(sfExposed))
+    bool exposedChanged = aState == sfExposed && enable != getState(sfExposed);
+    if (exposedChanged)
         ownerBufferChanged = true;
 
     TView::setState(aState, enable);
 
+    if (exposedChanged)
+        updateVisibility();
+
     if (aState == sfFocused)
     {
         TerminalEvent termEvent;
@@ -61,17 +189,39 @@ void TerminalView::handleEvent(TEvent &ev)
     switch (ev.what)
     {
         case evBroadcast:
-            if ( ev.message.command == consts.cmCheckTerminalUpdates &&
-                 termCtrl.stateHasBeenUpdated() )
-                drawView();
+            if (ev.message.command == consts.cmCheckTerminalUpdates)
+                checkUpdates();
+            break;
+
+        case evCommand:
+            if (ev.message.command == consts.cmFind)
+            {
+                startFinding();
+                clearEvent(ev);
+            }
             break;
 
         case evKeyDown:
         {
-            TerminalEvent termEvent;
-            termEvent.type = TerminalEventType::KeyDown;
-            termEvent.keyDown = ev.keyDown;
-            termCtrl.sendEvent(termEvent);
+            if ( (finding && handleFindKey(ev.keyDown)) ||
+                 handleScrollKey(ev.keyDown) )
+            {
+                clearEvent(ev);
+                break;
+            }
+            // Typing brings the view back to the terminal screen.
+            if (scrolling)
+                endScrolling();
+
+            if (ev.keyDown.controlKeyState & kbPaste)
+                sendPaste(ev);
+            else
+            {
+                TerminalEvent termEvent;
+                termEvent.type = TerminalEventType::KeyDown;
+                termEvent.keyDown = ev.keyDown;
+                termCtrl.sendEvent(termEvent);
+            }
 
             clearEvent(ev);
             break;
@@ -87,6 +237,11 @@ void TerminalView::handleEvent(TEvent &ev)
             break;
 
         case evMouseWheel:
+            if (!handleScrollWheel(ev.mouse))
+                handleMouse(ev.what, ev.mouse);
+            clearEvent(ev);
+            break;
+
         case evMouseMove:
         case evMouseAuto:
         case evMouseUp:
@@ -96,8 +251,31 @@ void TerminalView::handleEvent(TEvent &ev)
     }
 }
 
+void TerminalView::sendPaste(TEvent &ev) noexcept
+// Sends the text of 'ev' and of the text events which follow it as a single
+// Paste event, rather than as one KeyDown event per character.
+{
+    std::string text;
+    char buf[4096];
+    size_t length;
+    while (textEvent(ev, {buf, sizeof(buf)}, length))
+        text.append(buf, length);
+    if (!text.empty())
+    {
+        TerminalEvent termEvent;
+        termEvent.type = TerminalEventType::Paste;
+        termEvent.paste = {new char[text.size()], text.size(), true, true};
+        memcpy(termEvent.paste.data, text.data(), text.size());
+        termCtrl.sendEvent(termEvent);
+    }
+}
+
 void TerminalView::handleMouse(ushort what, MouseEventType mouse) noexcept
 {
+    // The positions would not match what the client displays.
+    if (scrolling)
+        return;
+
     mouse.where = makeLocal(mouse.where);
 
     TerminalEvent termEvent;
@@ -106,11 +284,309 @@ void TerminalView::handleMouse(ushort what, MouseEventType mouse) noexcept
     termCtrl.sendEvent(termEvent);
 }
 
+bool TerminalView::handleScrollKey(const KeyDownEvent &keyDown) noexcept
+{
+    int page = max(size.y - 1, 1);
+    TKey key(keyDown);
+    if (key == TKey(kbPgUp, kbShift))
+        scrollBack(page);
+    else if (scrolling && key == TKey(kbPgDn, kbShift))
+        scrollBack(-page);
+    else if (scrolling && key == TKey(kbUp, kbShift))
+        scrollBack(1);
+    else if (scrolling && key == TKey(kbDown, kbShift))
+        scrollBack(-1);
+    else if (scrolling && key == TKey(kbEsc))
+        endScrolling();
+    else
+        return false;
+    return true;
+}
+
+bool TerminalView::handleScrollWheel(const MouseEventType &mouse) noexcept
+{
+    enum { wheelLines = 3 };
+    // Unless it is already scrolling back, the view only takes the wheel if
+    // the client does not want it.
+    if (mouse.wheel == mwUp && (scrolling || !wheelCaptured))
+        scrollBack(wheelLines);
+    else if (mouse.wheel == mwDown && scrolling)
+        scrollBack(-wheelLines);
+    else
+        return false;
+    return true;
+}
+
+void TerminalView::scrollBack(int lines) noexcept
+// Scrolls up by 'lines' lines, or down if negative.
+{
+    bool atScreen = true;
+    termCtrl.useScrollback([&] (ScrollbackStore &store) {
+        if (!scrolling)
+        {
+            scrollLine = store.endLine();
+            scrollRow = 0;
+        }
+        clampScrollPosition(store);
+        moveScrollPosition(store, lines);
+        atScreen = scrollLine == store.endLine();
+    });
+    // While finding, the view keeps showing the find bar.
+    if (!atScreen || finding)
+    {
+        scrolling = true;
+        drawView();
+    }
+    else if (scrolling)
+        endScrolling();
+}
+
+void TerminalView::clampScrollPosition(ScrollbackStore &store) noexcept
+// Makes the scroll position valid again after lines were added to or removed
+// from the scrollback. A line which begins a logical line keeps doing so.
+{
+    size_t begin = store.beginLine();
+    size_t end = store.endLine();
+    if (scrollLine < begin || scrollLine > end)
+    {
+        scrollLine = scrollLine < begin ? begin : end;
+        scrollRow = 0;
+    }
+}
+
+void TerminalView::moveScrollPosition(ScrollbackStore &store, int rows) noexcept
+// Moves the scroll position up by 'rows' rows, or down if negative. Only the
+// logical lines which are moved past are wrapped.
+{
+    size_t width = max(size.x, 1);
+    if (rows > 0)
+    {
+        size_t n = rows;
+        while (n > scrollRow && scrollLine > store.beginLine())
+        {
+            n -= scrollRow;
+            size_t end = scrollLine;
+            scrollLine = store.logicalLineBegin(end - 1);
+            scrollRow = store.drawWrapped(scrollLine, end, width, wrappedCells);
+        }
+        scrollRow -= min(n, scrollRow);
+    }
+    else
+    {
+        size_t n = -(ptrdiff_t) rows;
+        while (n > 0 && scrollLine < store.endLine())
+        {
+            size_t next = store.logicalLineEnd(scrollLine);
+            size_t count = store.drawWrapped(scrollLine, next, width, wrappedCells);
+            // The row may be past the end of the line if the view got wider.
+            scrollRow = min(scrollRow, count - 1);
+            if (scrollRow + n < count)
+            {
+                scrollRow += n;
+                break;
+            }
+            n -= count - scrollRow;
+            scrollLine = next;
+            scrollRow = 0;
+        }
+    }
+}
+
+void TerminalView::setScrollPosition(ScrollbackStore &store, size_t id) noexcept
+// Scrolls so that the line with the given id is near the top of the view, or
+// to the terminal screen if there is no such line.
+{
+    size_t begin = store.beginLine();
+    size_t end = store.endLine();
+    scrollRow = 0;
+    if (id >= end)
+        scrollLine = end;
+    else
+    {
+        id = max(id, begin);
+        scrollLine = store.logicalLineBegin(id);
+        if (id > scrollLine)
+        {
+            // The row in which the preceding part of the logical line ends.
+            size_t width = max(size.x, 1);
+            scrollRow = store.drawWrapped(scrollLine, id, width, wrappedCells) - 1;
+        }
+        moveScrollPosition(store, max(size.y/3, 0));
+    }
+}
+
+void TerminalView::endScrolling() noexcept
+{
+    scrolling = false;
+    scrollingEnded = true;
+    drawView();
+}
+
+void TerminalView::startFinding() noexcept
+{
+    if (finding)
+        return;
+    bool hasScrollback = termCtrl.useScrollback([&] (ScrollbackStore &store) {
+        if (!scrolling)
+        {
+            scrollLine = store.endLine();
+            scrollRow = 0;
+        }
+    });
+    if (hasScrollback)
+    {
+        findingViews.push_back(this);
+        finding = true;
+        scrolling = true;
+        findLine = SIZE_MAX;
+        drawView();
+    }
+}
+
+void TerminalView::showFoundLine(TStringView text, size_t line) noexcept
+{
+    startFinding();
+    if (finding)
+    {
+        findText.assign(text.data(), text.size());
+        updateFind();
+        findJumpPending = false;
+        findLine = line;
+        scrollToLine(line);
+    }
+}
+
+bool TerminalView::handleFindKey(const KeyDownEvent &keyDown) noexcept
+// Pre: 'finding' is true.
+{
+    int page = max(size.y - 1, 1);
+    TKey key(keyDown);
+    if (key == TKey(kbEsc))
+        endFinding();
+    else if (key == TKey(kbEnter) || key == TKey(kbUp))
+        findNext(true);
+    else if (key == TKey(kbDown))
+        findNext(false);
+    else if (key == TKey(kbPgUp))
+        scrollBack(page);
+    else if (key == TKey(kbPgDn))
+        scrollBack(-page);
+    else if (key == TKey(kbBack))
+    {
+        if (!findText.empty())
+        {
+            findText.resize(findText.size() - TText::prev(findText, findText.size()));
+            updateFind();
+        }
+    }
+    else if (keyDown.textLength > 0 && !(keyDown.controlKeyState & (kbCtrlShift | kbAltShift)))
+    {
+        findText.append(keyDown.text, keyDown.textLength);
+        updateFind();
+    }
+    else
+        // Other keys are not meant for the terminal while finding, so they
+        // are ignored unless they are for scrolling.
+        handleScrollKey(keyDown);
+    return true;
+}
+
+void TerminalView::updateFind() noexcept
+// Restarts the search after 'findText' changed.
+{
+    // The finder locks the store by itself, so it must not be started with
+    // the store locked.
+    ScrollbackStore *scrollback = nullptr;
+    termCtrl.useScrollback([&] (ScrollbackStore &store) {
+        scrollback = &store;
+    });
+    if (scrollback)
+        finder.start(*scrollback, findText);
+    findLine = SIZE_MAX;
+    findJumpPending = !findText.empty();
+    drawView();
+}
+
+void TerminalView::findNext(bool older) noexcept
+// Visits the next line containing the text, in either direction. Going past
+// the most recent one returns to the terminal screen.
+{
+    size_t line = SIZE_MAX;
+    bool found = finder.useResults([&] (const ScrollbackFinder::Results &results) {
+        // The lines are sorted from the most recent to the oldest.
+        auto &lines = results.lines;
+        if (older)
+        {
+            auto it = std::upper_bound(
+                lines.begin(), lines.end(), findLine, std::greater<size_t>()
+            );
+            if (it == lines.end())
+                return false;
+            line = *it;
+        }
+        else if (findLine != SIZE_MAX)
+        {
+            auto it = std::lower_bound(
+                lines.begin(), lines.end(), findLine, std::greater<size_t>()
+            );
+            if (it != lines.begin())
+                line = *--it;
+        }
+        return true;
+    });
+    if (found)
+    {
+        findJumpPending = false;
+        findLine = line;
+        scrollToLine(line);
+    }
+}
+
+void TerminalView::scrollToLine(size_t id) noexcept
+// Scrolls so that the line with the given id is near the top of the view, or
+// to the terminal screen if 'id' is SIZE_MAX.
+{
+    termCtrl.useScrollback([&] (ScrollbackStore &store) {
+        setScrollPosition(store, id);
+    });
+    drawView();
+}
+
+void TerminalView::endFinding() noexcept
+{
+    finder.cancel();
+    removeFromFindingViews();
+    finding = false;
+    findJumpPending = false;
+    findText.clear();
+    endScrolling();
+}
+
 void TerminalView::draw()
 {
-    termCtrl.lockState([&] (auto &state) {
-        updateCursor(state);
-        updateDisplay(state.surface);
+    // Views are drawn when they become uncovered, but not when they become
+    // covered, which 'updateVisibilities' takes care of.
+    updateVisibility();
+    termCtrl.useState([&] (auto &state) {
+        wheelCaptured = state.wheelCaptured;
+        if (scrolling && !drawScrollback(state))
+        {
+            // The lines we were looking at went back to the screen.
+            scrolling = false;
+            scrollingEnded = true;
+        }
+        if (!scrolling)
+        {
+            if (scrollingEnded)
+            {
+                // Nothing of what was drawn can be reused.
+                scrollingEnded = false;
+                ownerBufferChanged = true;
+                state.cursorChanged = true;
+            }
+            updateCursor(state);
+            updateDisplay(state.surface);
+        }
 
         TerminalUpdatedMsg upd {*this, state};
         message(owner, evCommand, consts.cmTerminalUpdated, &upd);
@@ -157,6 +633,192 @@ void TerminalView::updateDisplay(TerminalSurface &surface) noexcept
     }
 }
 
+bool TerminalView::drawScrollback(TerminalState &state) noexcept
+// Returns false if there are no scrollback lines to show.
+{
+    if (size.x <= 0 || size.y <= 0)
+        return true;
+    auto &surface = scrollbackSurface;
+    surface.resize(size);
+    rowLines.resize(size.y);
+    int rows = 0;
+    size_t currentLine = SIZE_MAX;
+    // Only the visible lines are accessed, so that the emulator, which may be
+    // waiting to push lines into the scrollback, is not held for long.
+    termCtrl.useScrollback([&] (ScrollbackStore &store) {
+        clampScrollPosition(store);
+        size_t end = store.endLine();
+        if (store.beginLine() <= findLine && findLine < end)
+            currentLine = store.logicalLineBegin(findLine);
+        size_t line = scrollLine;
+        size_t width = max(size.x, 1);
+        while (rows < size.y && line < end)
+        {
+            size_t next = store.logicalLineEnd(line);
+            size_t count = store.drawWrapped(line, next, width, wrappedCells);
+            size_t row = 0;
+            if (line == scrollLine)
+                row = scrollRow = min(scrollRow, count - 1);
+            for (; row < count && rows < size.y; ++row, ++rows)
+            {
+                memcpy( &surface.at(rows, 0), &wrappedCells[row*width],
+                        size.x*sizeof(TScreenCell) );
+                rowLines[rows] = line;
+            }
+            line = next;
+        }
+    });
+    if (rows == 0 && !finding)
+        return false;
+
+    // Below the scrollback comes the top of the terminal screen.
+    auto &screen = state.surface;
+    for (int y = rows; y < size.y; ++y)
+    {
+        TSpan<TScreenCell> cells {&surface.at(y, 0), (size_t) size.x};
+        drawScrollbackLine(cells, {});
+        int sy = y - rows;
+        if (sy < screen.size.y)
+            memcpy( cells.data(), &screen.at(sy, 0),
+                    min(size.x, screen.size.x)*sizeof(TScreenCell) );
+    }
+    // The screen will be drawn from scratch when we stop scrolling.
+    screen.clearDamage();
+
+    int cursorY = state.cursorPos.y + rows;
+    state.cursorChanged = false;
+    setState(sfCursorVis, state.cursorVisible && cursorY < size.y);
+    setCursor(state.cursorPos.x, cursorY);
+
+    if (finding)
+    {
+        int matches = highlightMatches(rows, currentLine);
+        if (findJumpPending && matches == 0)
+        {
+            // As the text is typed, go to the most recent line containing
+            // it, unless it can already be seen.
+            size_t line = SIZE_MAX;
+            bool done = finder.useResults([&] (const ScrollbackFinder::Results &results) {
+                if (!results.lines.empty())
+                    line = results.lines.front();
+                return results.done;
+            });
+            if (line != SIZE_MAX)
+            {
+                findJumpPending = false;
+                findLine = line;
+                termCtrl.useScrollback([&] (ScrollbackStore &store) {
+                    setScrollPosition(store, line);
+                });
+                return drawScrollback(state);
+            }
+            findJumpPending = !done;
+        }
+        else
+            findJumpPending = false;
+        drawFindBar();
+    }
+
+    for (int y = 0; y < size.y; ++y)
+        writeLine(0, y, size.x, 1, &surface.at(y, 0));
+    return true;
+}
+
+enum : uchar
+{
+    findBarColor = 0x70,
+    matchColor = 0xE0,
+    currentMatchColor = 0xA0,
+};
+
+template <class Func>
+static void findInRow( TSpan<const TScreenCell> cells, TStringView text,
+                       bool ignoreCase, std::string &buf, std::vector<int> &columns,
+                       Func &&onMatch )
+// Invokes 'onMatch' with the range of columns of every occurrence of 'text'
+// in 'cells'.
+// Pre: 'text' is not empty.
+{
+    buf.clear();
+    columns.clear();
+    for (size_t x = 0; x < cells.size(); ++x)
+    {
+        auto &ch = cells[x]._ch;
+        if (ch.isWideCharTrail())
+            continue;
+        TStringView cellText = ch.getText();
+        if (cellText.empty())
+            cellText = " ";
+        buf.append(cellText.data(), cellText.size());
+        columns.insert(columns.end(), cellText.size(), (int) x);
+    }
+    columns.push_back((int) cells.size());
+    size_t pos = 0;
+    while ( (pos += findSubstring( &buf[pos], buf.size() - pos,
+                                   text.data(), text.size(), ignoreCase )) < buf.size() )
+    {
+        size_t end = pos + text.size();
+        onMatch(columns[pos], columns[end]);
+        pos = end;
+    }
+}
+
+int TerminalView::highlightMatches(int rows, size_t currentLine) noexcept
+// Highlights the occurrences of 'findText' in the rows of 'scrollbackSurface'
+// above the find bar, of which the first 'rows' ones come from the
+// scrollback. Those in the logical line beginning at 'currentLine' are
+// highlighted differently. Returns the number of occurrences.
+{
+    if (findText.empty())
+        return 0;
+    bool ignoreCase = ScrollbackFinder::ignoresCase(findText);
+    std::string buf;
+    std::vector<int> columns;
+    int count = 0;
+    for (int y = 0; y < size.y - 1; ++y)
+    {
+        TSpan<TScreenCell> cells {&scrollbackSurface.at(y, 0), (size_t) size.x};
+        TColorAttr attr = y < rows && rowLines[y] == currentLine ? currentMatchColor
+                                                                 : matchColor;
+        findInRow(cells, findText, ignoreCase, buf, columns, [&] (int begin, int end) {
+            for (int x = begin; x < end; ++x)
+                ::setAttr(cells[x], attr);
+            ++count;
+        });
+    }
+    return count;
+}
+
+void TerminalView::drawFindBar() noexcept
+{
+    TSpan<TScreenCell> cells {&scrollbackSurface.at(size.y - 1, 0), (size_t) size.x};
+    TColorAttr attr = findBarColor;
+    for (auto &cell : cells)
+    {
+        ::setChar(cell, ' ');
+        ::setAttr(cell, attr);
+    }
+    size_t x = TText::drawStr(cells, 0, " Find: ", 0, attr);
+    x += TText::drawStr(cells, x, findText, 0, attr);
+    setState(sfCursorVis, x < cells.size());
+    setState(sfCursorIns, False);
+    setCursor(x, size.y - 1);
+
+    if (!findText.empty())
+    {
+        char status[64];
+        finder.useResults([&] (const ScrollbackFinder::Results &results) {
+            size_t count = results.lines.size();
+            snprintf( status, sizeof(status), " %zu %s%s ", count,
+                      count == 1 ? "line" : "lines",
+                      results.done ? "" : ", searching..." );
+        });
+        size_t width = TText::width(status);
+        if (x + width < cells.size())
+            TText::drawStr(cells, cells.size() - width, status, 0, attr);
+    }
+}
+
 bool TerminalView::canReuseOwnerBuffer() noexcept
 {
     if (ownerBufferChanged)
@@ -44,6 +44,23 @@ void BasicTerminalWindow::checkChanges(TerminalUpdatedMsg &upd) noexcept
         frame->drawView();
 }
 
+void BasicTerminalWindow::close()
+// Same as 'TWindow::close', which we cannot invoke after 'valid', since it
+// would ask for confirmation again.
+{
+    if (valid(cmClose))
+    {
+        // Unlike when the application exits, the user does not want to see
+        // this terminal again, so its scrollback does not have to be kept.
+        if (view)
+            view->termCtrl.useScrollback([] (auto &store) {
+                store.removeArchiveOnClose();
+            });
+        frame = nullptr;
+        destroy(this);
+    }
+}
+
 bool BasicTerminalWindow::updateTitle( TerminalController &term,
                                        TerminalState &state ) noexcept
 {
@@ -51,6 +68,12 @@ bool BasicTerminalWindow::updateTitle( TerminalController &term,
     {
         state.titleChanged = false;
         termTitle = std::move(state.title);
+        notReading = term.clientIsNotReading();
+        return true;
+    }
+    if (notReading != term.clientIsNotReading())
+    {
+        notReading = !notReading;
         return true;
     }
     // When the terminal is closed for the first time, 'state.title' does not
@@ -58,6 +81,22 @@ bool BasicTerminalWindow::updateTitle( TerminalController &term,
     return term.clientIsDisconnected();
 }
 
+ScrollbackStore *BasicTerminalWindow::getScrollback() noexcept
+{
+    ScrollbackStore *scrollback = nullptr;
+    if (view)
+        view->termCtrl.useScrollback([&] (ScrollbackStore &store) {
+            scrollback = &store;
+        });
+    return scrollback;
+}
+
+void BasicTerminalWindow::showFoundLine(TStringView text, size_t line) noexcept
+{
+    if (view)
+        view->showFoundLine(text, line);
+}
+
 void BasicTerminalWindow::resizeTitle(size_t aCapacity)
 {
     if (titleCapacity < aCapacity)
@@ -77,6 +116,7 @@ bool BasicTerminalWindow::isDisconnected() const noexcept
 const char *BasicTerminalWindow::getTitle(short)
 {
     TStringView tail = isDisconnected()                 ? " (Disconnected)"
+                     : notReading                       ? " (Not Reading Input)"
                      : helpCtx == consts.hcInputGrabbed ? " (Input Grab)"
                                                         : "";
     TStringView text = {termTitle.data(), termTitle.size()};
@@ -0,0 +1,772 @@
+#include "reactor.h"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+
+// Provided buffer rings (and the header definitions for them) were introduced
+// in Linux 5.19, together with IORING_SETUP_SQE128.
+#if defined(IORING_SETUP_SQE128)
+
+#include <tvterm/array.h>
+#include <tvterm/mutex.h>
+#include <tvterm/debug.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+
+namespace tvterm
+{
+
+namespace uring
+{
+
+    // Opcode of multishot reads, which were introduced in Linux 6.7. Kernel
+    // headers may not define it yet.
+    enum : uint8_t { opReadMultishot = 49 };
+
+    static int setup(unsigned entries, io_uring_params &params) noexcept
+    {
+        return (int) syscall(__NR_io_uring_setup, entries, &params);
+    }
+
+    static int enter( int fd, unsigned toSubmit, unsigned minComplete,
+                      unsigned flags, void *arg, size_t argSize ) noexcept
+    {
+        return (int) syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize);
+    }
+
+    static int registerOp(int fd, unsigned opcode, void *arg, unsigned nrArgs) noexcept
+    {
+        return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+    }
+
+    template <class T>
+    static inline T loadAcquire(const T *p) noexcept
+    {
+        return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+    }
+
+    template <class T>
+    static inline void storeRelease(T *p, T value) noexcept
+    {
+        __atomic_store_n(p, value, __ATOMIC_RELEASE);
+    }
+
+} // namespace uring
+
+// The UringReactor has the same structure as the EpollReactor (a small set of
+// worker threads, each of them owning a set of clients), but instead of
+// waiting for readiness and then reading, each worker keeps a read request in
+// flight for every client in its own io_uring instance. Reads pick a buffer
+// from a ring of provided buffers shared by all of the worker's clients, so
+// that no memory has to be reserved per client. When supported, reads are
+// multishot, so they only have to be submitted once.
+//
+// Multishot reads on a pty are not terminated when the other end gets closed,
+// so in that case we also wait for POLLHUP and then fall back to regular reads,
+// which drain the remaining data and then fail with EIO.
+//
+// When a client does not take all the data it is given, the read request is
+// cancelled and no other one is submitted until the client has taken the rest.
+
+class UringReactor final : public IoReactor
+{
+public:
+
+    static UringReactor *create() noexcept;
+
+    std::shared_ptr<Handle> add(int fd, std::shared_ptr<IoReactorClient> client) noexcept override;
+    void wakeUp(Handle &handle) noexcept override;
+    void setTimeout(Handle &handle, TimePoint timeout) noexcept override;
+    void write(Handle &handle, TSpan<const char> data) noexcept override;
+    size_t getPendingOutput(Handle &handle) noexcept override;
+    std::shared_ptr<IoReactorClient> remove(Handle &handle) noexcept override;
+
+private:
+
+    enum { maxWorkers = 4 };
+    enum { ringEntries = 256 };
+    enum { bufCount = 64, bufSize = 16384, bufGroup = 0 };
+
+    // Operation tags stored in the low bits of the 'user_data' field.
+    enum : uint64_t { opRead = 0, opWrite = 1, opWakeUp = 2, opCancel = 3, opHangUp = 4, opMask = 7 };
+
+    struct Worker;
+
+    struct Slot final : Handle
+    {
+        Worker &worker;
+        int fd;
+        std::shared_ptr<IoReactorClient> client;
+        TimePoint timeout {};
+        bool adopted {false};
+        bool polling {false};
+        bool reading {false};
+        bool waitingHangUp {false};
+        bool hungUp {false};
+        // Number of requests which reference this slot and have not completed
+        // yet. The slot must be kept alive until this drops to zero.
+        size_t requestsInFlight {0};
+        std::atomic<bool> wakeUpPending {false};
+
+        // 'writing' is the data in the write request currently in flight. It
+        // must not be modified until the request completes, so new data is
+        // appended to 'queued' instead.
+        GrowArray writing;
+        size_t writingOffset {0};
+        GrowArray queued;
+
+        // Data which was read but not taken by the client yet.
+        GrowArray input;
+        size_t inputOffset {0};
+
+        Slot(Worker &aWorker, int aFd, std::shared_ptr<IoReactorClient> aClient) noexcept :
+            worker(aWorker),
+            fd(aFd),
+            client(std::move(aClient))
+        {
+        }
+    };
+
+    struct Worker
+    {
+        int ringFd {-1};
+        int eventFd {-1};
+        bool multishotRead {false};
+        std::atomic<size_t> clientCount {0};
+
+        // Submission queue.
+        unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+        io_uring_sqe *sqes;
+        unsigned sqPending {0};
+        // Completion queue.
+        unsigned *cqHead, *cqTail, *cqMask;
+        io_uring_cqe *cqes;
+
+        // Provided buffers.
+        io_uring_buf_ring *bufRing {nullptr};
+        char *bufs {nullptr};
+        uint16_t bufRingTail {0};
+
+        uint64_t eventFdValue {0};
+
+        // Only accessed from the worker thread.
+        std::vector<std::shared_ptr<Slot>> slots;
+
+        // Slots which requested to be woken up.
+        Mutex<std::vector<std::shared_ptr<Slot>>> wakeUpList;
+
+        bool init() noexcept;
+        bool initBuffers() noexcept;
+        void run() noexcept;
+        io_uring_sqe &getSqe() noexcept;
+        void submit(bool wait, TimePoint timeout) noexcept;
+        void provideBuffer(uint16_t bid) noexcept;
+        void submitWakeUpRead() noexcept;
+        void submitRead(Slot &slot) noexcept;
+        void submitWrite(Slot &slot) noexcept;
+        void submitHangUpPoll(Slot &slot) noexcept;
+        void submitCancel(Slot &slot, uint64_t op) noexcept;
+        void processCompletion(const io_uring_cqe &cqe) noexcept;
+        void processRead(Slot &slot, const io_uring_cqe &cqe) noexcept;
+        void processWrite(Slot &slot, const io_uring_cqe &cqe) noexcept;
+        void resumeInput(Slot &slot) noexcept;
+        void processHangUp(Slot &slot, const io_uring_cqe &cqe) noexcept;
+        void processWakeUps() noexcept;
+        void processTimeouts() noexcept;
+        TimePoint nextTimeout() noexcept;
+        void adopt(Slot &slot) noexcept;
+        void stopPolling(Slot &slot) noexcept;
+        void disconnect(Slot &slot) noexcept;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    UringReactor() = default;
+    Worker &pickWorker() noexcept;
+};
+
+IoReactor *createUringReactor() noexcept
+{
+    return UringReactor::create();
+}
+
+UringReactor *UringReactor::create() noexcept
+{
+    size_t workerCount = ::min<size_t>(::max(std::thread::hardware_concurrency()/2, 1U), maxWorkers);
+
+    auto &reactor = *new UringReactor;
+    for (size_t i = 0; i < workerCount; ++i)
+    {
+        std::unique_ptr<Worker> worker {new Worker};
+        if (!worker->init())
+            // Note that the resources of a worker which failed to initialize
+            // are leaked, but this only happens once per process.
+            break;
+        reactor.workers.push_back(std::move(worker));
+    }
+
+    if (reactor.workers.empty())
+    {
+        delete &reactor;
+        return nullptr;
+    }
+
+    for (auto &worker : reactor.workers)
+        std::thread([&worker = *worker] {
+            worker.run();
+        }).detach();
+
+    return &reactor;
+}
+
+bool UringReactor::Worker::init() noexcept
+{
+    io_uring_params params {};
+    params.flags = IORING_SETUP_CLAMP;
+    if ((ringFd = uring::setup(ringEntries, params)) < 0)
+        return false;
+
+    // We need IORING_FEAT_EXT_ARG for waiting with a timeout. Other than that,
+    // only the features of Linux 5.19 are required.
+    if ( !(params.features & IORING_FEAT_SINGLE_MMAP) ||
+         !(params.features & IORING_FEAT_EXT_ARG) )
+        return false;
+
+    size_t sqSize = params.sq_off.array + params.sq_entries*sizeof(unsigned);
+    size_t cqSize = params.cq_off.cqes + params.cq_entries*sizeof(io_uring_cqe);
+    size_t ringSize = ::max(sqSize, cqSize);
+    auto *ring = (char *) mmap( nullptr, ringSize, PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING );
+    if (ring == MAP_FAILED)
+        return false;
+    sqes = (io_uring_sqe *) mmap( nullptr, params.sq_entries*sizeof(io_uring_sqe),
+                                  PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                  ringFd, IORING_OFF_SQES );
+    if (sqes == MAP_FAILED)
+        return false;
+
+    sqHead = (unsigned *) (ring + params.sq_off.head);
+    sqTail = (unsigned *) (ring + params.sq_off.tail);
+    sqMask = (unsigned *) (ring + params.sq_off.ring_mask);
+    sqArray = (unsigned *) (ring + params.sq_off.array);
+    cqHead = (unsigned *) (ring + params.cq_off.head);
+    cqTail = (unsigned *) (ring + params.cq_off.tail);
+    cqMask = (unsigned *) (ring + params.cq_off.ring_mask);
+    cqes = (io_uring_cqe *) (ring + params.cq_off.cqes);
+
+    // Check whether multishot reads are supported.
+    enum { probeOps = 256 };
+    size_t probeSize = sizeof(io_uring_probe) + probeOps*sizeof(io_uring_probe_op);
+    std::vector<char> probeBuf(probeSize);
+    auto &probe = *(io_uring_probe *) probeBuf.data();
+    if (uring::registerOp(ringFd, IORING_REGISTER_PROBE, &probe, probeOps) == 0)
+        multishotRead = uring::opReadMultishot <= probe.last_op &&
+                        (probe.ops[uring::opReadMultishot].flags & IO_URING_OP_SUPPORTED);
+
+    if (!initBuffers())
+        return false;
+
+    if ((eventFd = eventfd(0, EFD_CLOEXEC)) == -1)
+        return false;
+    submitWakeUpRead();
+    return true;
+}
+
+bool UringReactor::Worker::initBuffers() noexcept
+{
+    size_t ringSize = bufCount*sizeof(io_uring_buf);
+    void *ring = mmap( nullptr, ringSize, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if (ring == MAP_FAILED)
+        return false;
+    bufRing = (io_uring_buf_ring *) ring;
+
+    io_uring_buf_reg reg {};
+    reg.ring_addr = (uint64_t) ring;
+    reg.ring_entries = bufCount;
+    reg.bgid = bufGroup;
+    if (uring::registerOp(ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+        return false;
+
+    if (!(bufs = (char *) malloc(bufCount*bufSize)))
+        return false;
+    for (uint16_t bid = 0; bid < bufCount; ++bid)
+        provideBuffer(bid);
+    return true;
+}
+
+void UringReactor::Worker::provideBuffer(uint16_t bid) noexcept
+{
+    // Do not use 'bufRing->bufs': in C++, the kernel headers give it the
+    // wrong offset.
+    auto &buf = ((io_uring_buf *) bufRing)[bufRingTail & (bufCount - 1)];
+    buf.addr = (uint64_t) &bufs[bid*bufSize];
+    buf.len = bufSize;
+    buf.bid = bid;
+    uring::storeRelease(&bufRing->tail, ++bufRingTail);
+}
+
+UringReactor::Worker &UringReactor::pickWorker() noexcept
+{
+    Worker *result = workers[0].get();
+    for (auto &worker : workers)
+        if (worker->clientCount < result->clientCount)
+            result = worker.get();
+    return *result;
+}
+
+std::shared_ptr<IoReactor::Handle> UringReactor::add(int fd, std::shared_ptr<IoReactorClient> client) noexcept
+{
+    // Unlike with epoll, the file descriptor must be in blocking mode, but
+    // PtyMaster makes it non-blocking. io_uring honours O_NONBLOCK: requests
+    // on such a file complete with -EAGAIN instead of waiting until it is
+    // ready, and they would be submitted again over and over. Writes do not
+    // block the worker anyway, since the kernel completes them
+    // asynchronously.
+    int flags = fcntl(fd, F_GETFL);
+    if (flags == -1 || fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) == -1)
+        return nullptr;
+
+    auto &worker = pickWorker();
+    auto slot = std::make_shared<Slot>(worker, fd, std::move(client));
+    ++worker.clientCount;
+    // The worker will submit the first read request once it processes the
+    // wake-up.
+    wakeUp(*slot);
+    return slot;
+}
+
+void UringReactor::wakeUp(Handle &handle) noexcept
+{
+    auto &slot = (Slot &) handle;
+    if (!slot.wakeUpPending.exchange(true))
+    {
+        auto &worker = slot.worker;
+        worker.wakeUpList.lock([&] (auto &wakeUpList) {
+            wakeUpList.push_back(std::static_pointer_cast<Slot>(slot.shared_from_this()));
+        });
+        uint64_t one = 1;
+        ssize_t r = ::write(worker.eventFd, &one, sizeof(one));
+        (void) r;
+    }
+}
+
+void UringReactor::setTimeout(Handle &handle, TimePoint timeout) noexcept
+{
+    auto &slot = (Slot &) handle;
+    slot.timeout = timeout;
+}
+
+void UringReactor::write(Handle &handle, TSpan<const char> data) noexcept
+{
+    auto &slot = (Slot &) handle;
+    if (slot.polling && data.size() > 0)
+    {
+        slot.queued.push(&data[0], data.size());
+        if (slot.writing.size() == 0)
+            slot.worker.submitWrite(slot);
+    }
+}
+
+size_t UringReactor::getPendingOutput(Handle &handle) noexcept
+{
+    auto &slot = (Slot &) handle;
+    return slot.writing.size() - slot.writingOffset + slot.queued.size();
+}
+
+std::shared_ptr<IoReactorClient> UringReactor::remove(Handle &handle) noexcept
+{
+    auto &slot = (Slot &) handle;
+    auto &worker = slot.worker;
+    worker.stopPolling(slot);
+    slot.timeout = TimePoint();
+    --worker.clientCount;
+    // The slot will be erased from 'worker.slots' once all of its requests
+    // have completed.
+    return std::move(slot.client);
+}
+
+io_uring_sqe &UringReactor::Worker::getSqe() noexcept
+{
+    unsigned tail = *sqTail;
+    if (tail - uring::loadAcquire(sqHead) > *sqMask)
+    {
+        // The submission queue is full. Submit what we have so far.
+        submit(false, TimePoint());
+        tail = *sqTail;
+    }
+    unsigned index = tail & *sqMask;
+    auto &sqe = sqes[index];
+    memset(&sqe, 0, sizeof(sqe));
+    sqArray[index] = index;
+    uring::storeRelease(sqTail, tail + 1);
+    ++sqPending;
+    return sqe;
+}
+
+void UringReactor::Worker::submit(bool wait, TimePoint timeout) noexcept
+{
+    unsigned flags = 0;
+    unsigned minComplete = 0;
+    io_uring_getevents_arg arg {};
+    __kernel_timespec ts {};
+    if (wait)
+    {
+        flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        minComplete = 1;
+        if (timeout != TimePoint())
+        {
+            auto now = Clock::now();
+            auto ns = timeout > now
+                ? std::chrono::duration_cast<std::chrono::nanoseconds>(timeout - now).count()
+                : 0;
+            ts.tv_sec = ns/1000000000;
+            ts.tv_nsec = ns%1000000000;
+            arg.ts = (uint64_t) &ts;
+        }
+    }
+
+    int r = uring::enter(ringFd, sqPending, minComplete, flags, wait ? &arg : nullptr, wait ? sizeof(arg) : 0);
+    if (r >= 0)
+        sqPending -= ::min<unsigned>(r, sqPending);
+    else if (errno != EINTR && errno != ETIME && errno != EBUSY && errno != EAGAIN)
+        dout << "io_uring_enter failed: " << strerror(errno) << std::endl;
+}
+
+void UringReactor::Worker::submitWakeUpRead() noexcept
+{
+    auto &sqe = getSqe();
+    sqe.opcode = IORING_OP_READ;
+    sqe.fd = eventFd;
+    sqe.addr = (uint64_t) &eventFdValue;
+    sqe.len = sizeof(eventFdValue);
+    sqe.user_data = opWakeUp;
+}
+
+void UringReactor::Worker::submitRead(Slot &slot) noexcept
+{
+    auto &sqe = getSqe();
+    sqe.opcode = multishotRead && !slot.hungUp ? (uint8_t) uring::opReadMultishot : (uint8_t) IORING_OP_READ;
+    sqe.fd = slot.fd;
+    sqe.flags = IOSQE_BUFFER_SELECT;
+    sqe.buf_group = bufGroup;
+    // For non-seekable files such as ptys, an offset of -1 means the current
+    // position.
+    sqe.off = (uint64_t) -1;
+    sqe.user_data = (uint64_t) &slot | opRead;
+    slot.reading = true;
+    ++slot.requestsInFlight;
+}
+
+void UringReactor::Worker::submitWrite(Slot &slot) noexcept
+// Pre: there is no write request in flight for 'slot'.
+{
+    if (slot.writingOffset == slot.writing.size())
+    {
+        slot.writing.clear();
+        slot.writingOffset = 0;
+        std::swap(slot.writing, slot.queued);
+    }
+
+    if (slot.writing.size() > 0)
+    {
+        auto &sqe = getSqe();
+        sqe.opcode = IORING_OP_WRITE;
+        sqe.fd = slot.fd;
+        sqe.addr = (uint64_t) (slot.writing.data() + slot.writingOffset);
+        sqe.len = slot.writing.size() - slot.writingOffset;
+        sqe.off = (uint64_t) -1;
+        sqe.user_data = (uint64_t) &slot | opWrite;
+        ++slot.requestsInFlight;
+    }
+}
+
+void UringReactor::Worker::submitHangUpPoll(Slot &slot) noexcept
+{
+    auto &sqe = getSqe();
+    sqe.opcode = IORING_OP_POLL_ADD;
+    sqe.fd = slot.fd;
+    sqe.poll32_events = POLLHUP;
+    sqe.user_data = (uint64_t) &slot | opHangUp;
+    slot.waitingHangUp = true;
+    ++slot.requestsInFlight;
+}
+
+void UringReactor::Worker::submitCancel(Slot &slot, uint64_t op) noexcept
+{
+    auto &sqe = getSqe();
+    sqe.opcode = IORING_OP_ASYNC_CANCEL;
+    sqe.addr = (uint64_t) &slot | op;
+    sqe.user_data = opCancel;
+}
+
+void UringReactor::Worker::run() noexcept
+{
+    while (true)
+    {
+        submit(true, nextTimeout());
+
+        unsigned head = *cqHead;
+        unsigned tail = uring::loadAcquire(cqTail);
+        while (head != tail)
+        {
+            // Copy the entry so that its slot can be reused immediately.
+            io_uring_cqe cqe = cqes[head & *cqMask];
+            uring::storeRelease(cqHead, ++head);
+            processCompletion(cqe);
+            tail = uring::loadAcquire(cqTail);
+        }
+
+        processTimeouts();
+
+        for (size_t i = 0; i < slots.size();)
+            if (!slots[i]->client && slots[i]->requestsInFlight == 0)
+            {
+                slots[i] = std::move(slots.back());
+                slots.pop_back();
+            }
+            else
+                ++i;
+    }
+}
+
+void UringReactor::Worker::processCompletion(const io_uring_cqe &cqe) noexcept
+{
+    switch (cqe.user_data & opMask)
+    {
+        case opWakeUp:
+            submitWakeUpRead();
+            processWakeUps();
+            break;
+        case opCancel:
+            break;
+        default:
+        {
+            // The slot is kept alive by 'slots' while it has requests in
+            // flight, even if it gets removed in the meantime.
+            auto &slot = *(Slot *) (cqe.user_data & ~opMask);
+            switch (cqe.user_data & opMask)
+            {
+                case opRead: processRead(slot, cqe); break;
+                case opWrite: processWrite(slot, cqe); break;
+                case opHangUp: processHangUp(slot, cqe); break;
+            }
+            break;
+        }
+    }
+}
+
+void UringReactor::Worker::processRead(Slot &slot, const io_uring_cqe &cqe) noexcept
+{
+    bool more = cqe.flags & IORING_CQE_F_MORE;
+    if (!more)
+    {
+        slot.reading = false;
+        --slot.requestsInFlight;
+    }
+
+    if (cqe.flags & IORING_CQE_F_BUFFER)
+    {
+        uint16_t bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+        if (cqe.res > 0 && slot.client && slot.polling)
+        {
+            TSpan<const char> data {&bufs[bid*bufSize], (size_t) cqe.res};
+            size_t taken = 0;
+            // A multishot read may still complete after being cancelled.
+            if (slot.input.size() == 0)
+            {
+                auto client = slot.client;
+                taken = client->onClientData(data);
+                if (taken < data.size() && slot.polling && slot.reading)
+                    submitCancel(slot, opRead);
+            }
+            if (taken < data.size() && slot.polling)
+                slot.input.push(&data[taken], data.size() - taken);
+        }
+        provideBuffer(bid);
+    }
+
+    if (slot.client && slot.polling)
+    {
+        if ( cqe.res > 0 || cqe.res == -ENOBUFS || cqe.res == -EAGAIN ||
+             cqe.res == -EINTR || cqe.res == -ECANCELED )
+        {
+            // A read request finishes when it is not multishot, when a
+            // multishot one runs out of buffers, or when it gets cancelled
+            // because of a hang up or because the client is not taking more
+            // data. Submit it again unless the latter is still the case.
+            if (!slot.reading && slot.input.size() == 0)
+                submitRead(slot);
+        }
+        else if (slot.input.size() == 0)
+            // EOF or error (e.g. EIO once the client side has been closed).
+            // If there is still data for the client, the read will be
+            // submitted again and fail once the client has taken it.
+            disconnect(slot);
+    }
+}
+
+void UringReactor::Worker::resumeInput(Slot &slot) noexcept
+{
+    if (slot.polling && slot.input.size() > 0)
+    {
+        auto client = slot.client;
+        slot.inputOffset += client->onClientData({ slot.input.data() + slot.inputOffset,
+                                                   slot.input.size() - slot.inputOffset });
+        if (slot.polling && slot.inputOffset == slot.input.size())
+        {
+            slot.input.clear();
+            slot.inputOffset = 0;
+            if (!slot.reading)
+                submitRead(slot);
+        }
+    }
+}
+
+void UringReactor::Worker::processHangUp(Slot &slot, const io_uring_cqe &cqe) noexcept
+{
+    --slot.requestsInFlight;
+    slot.waitingHangUp = false;
+    if (cqe.res > 0 && slot.client && slot.polling)
+    {
+        // Replace the multishot read with a regular one.
+        slot.hungUp = true;
+        if (slot.reading)
+            submitCancel(slot, opRead);
+    }
+}
+
+void UringReactor::Worker::processWrite(Slot &slot, const io_uring_cqe &cqe) noexcept
+{
+    --slot.requestsInFlight;
+    if (slot.client && slot.polling)
+    {
+        if (cqe.res >= 0 || cqe.res == -EAGAIN || cqe.res == -EINTR)
+        {
+            if (cqe.res > 0)
+                slot.writingOffset += cqe.res;
+            submitWrite(slot);
+            if (slot.writing.size() == 0)
+            {
+                auto client = slot.client;
+                client->onWakeUp();
+            }
+        }
+        else
+            disconnect(slot);
+    }
+}
+
+void UringReactor::Worker::processWakeUps() noexcept
+{
+    std::vector<std::shared_ptr<Slot>> pending;
+    wakeUpList.lock([&] (auto &wakeUpList) {
+        pending.swap(wakeUpList);
+    });
+
+    for (auto &slot : pending)
+    {
+        slot->wakeUpPending = false;
+        if (slot->client)
+        {
+            if (!slot->adopted)
+            {
+                slots.push_back(slot);
+                adopt(*slot);
+            }
+            resumeInput(*slot);
+            if (slot->client)
+            {
+                auto client = slot->client;
+                client->onWakeUp();
+            }
+        }
+    }
+}
+
+void UringReactor::Worker::processTimeouts() noexcept
+{
+    auto now = Clock::now();
+    for (size_t i = 0; i < slots.size(); ++i)
+    {
+        auto &slot = *slots[i];
+        if (slot.client && slot.timeout != TimePoint() && slot.timeout <= now)
+        {
+            slot.timeout = TimePoint();
+            auto client = slot.client;
+            client->onWakeUp();
+        }
+    }
+}
+
+IoReactor::TimePoint UringReactor::Worker::nextTimeout() noexcept
+{
+    TimePoint timeout {};
+    for (auto &slot : slots)
+        if (slot->timeout != TimePoint() && (timeout == TimePoint() || slot->timeout < timeout))
+            timeout = slot->timeout;
+    return timeout;
+}
+
+void UringReactor::Worker::adopt(Slot &slot) noexcept
+{
+    slot.adopted = true;
+    slot.polling = true;
+    submitRead(slot);
+    if (multishotRead)
+        submitHangUpPoll(slot);
+}
+
+void UringReactor::Worker::stopPolling(Slot &slot) noexcept
+{
+    if (slot.polling)
+    {
+        slot.polling = false;
+        if (slot.reading)
+            submitCancel(slot, opRead);
+        if (slot.waitingHangUp)
+            submitCancel(slot, opHangUp);
+        // A write request in flight may still reference 'slot.writing', so
+        // only drop the data that has not been submitted yet.
+        slot.queued = GrowArray();
+        slot.input = GrowArray();
+        slot.inputOffset = 0;
+    }
+}
+
+void UringReactor::Worker::disconnect(Slot &slot) noexcept
+{
+    if (slot.polling)
+    {
+        stopPolling(slot);
+        auto client = slot.client;
+        client->onClientDisconnected();
+    }
+}
+
+} // namespace tvterm
+
+#else
+
+namespace tvterm
+{
+
+IoReactor *createUringReactor() noexcept
+{
+    return nullptr;
+}
+
+} // namespace tvterm
+
+#endif // IORING_SETUP_SQE128
@@ -48,4 +48,39 @@ inline constexpr uint32_t utf8To32(TStringView s)
     return 0;
 }
 
+// Returns the length of the UTF-8 sequence starting with 'lead', assuming it
+// is valid.
+inline constexpr size_t utf8SeqLength(char lead)
+{
+    return (uchar) lead < 0xC0 ? 1 : (uchar) lead < 0xE0 ? 2 : (uchar) lead < 0xF0 ? 3 : 4;
+}
+
+// Writes the UTF-8 encoding of 'ch' into 'dst' and returns its length.
+inline size_t utf32To8(uint32_t ch, char dst[4])
+{
+    if (ch < 0x80)
+    {
+        dst[0] = (char) ch;
+        return 1;
+    }
+    if (ch < 0x800)
+    {
+        dst[0] = (char) (0b1100'0000 | (ch >> 6));
+        dst[1] = (char) (0b1000'0000 | (ch & 0b0011'1111));
+        return 2;
+    }
+    if (ch < 0x10000)
+    {
+        dst[0] = (char) (0b1110'0000 | (ch >> 12));
+        dst[1] = (char) (0b1000'0000 | ((ch >> 6) & 0b0011'1111));
+        dst[2] = (char) (0b1000'0000 | (ch & 0b0011'1111));
+        return 3;
+    }
+    dst[0] = (char) (0b1111'0000 | ((ch >> 18) & 0b0000'0111));
+    dst[1] = (char) (0b1000'0000 | ((ch >> 12) & 0b0011'1111));
+    dst[2] = (char) (0b1000'0000 | ((ch >> 6) & 0b0011'1111));
+    dst[3] = (char) (0b1000'0000 | (ch & 0b0011'1111));
+    return 4;
+}
+
 #endif // TVTERM_UTIL_H
@@ -4,7 +4,9 @@
 #include <tvision/tv.h>
 
 #include "util.h"
+#include "simd.h"
 #include <tvterm/vtermemu.h>
+#include <tvterm/scrollarchive.h>
 #include <tvterm/debug.h>
 #include <unordered_map>
 
@@ -125,6 +127,27 @@ namespace vtermemu
             vterm_keyboard_key(vt, vtKey, vtMod);
     }
 
+    static void writePastedText(Writer &writer, TStringView text, bool &afterCR)
+    // Line feeds are sent as carriage returns, like the Enter key does, except
+    // when they follow one. 'afterCR' tells whether the previous chunk of
+    // text ended in a carriage return, and is updated for the next one.
+    {
+        size_t begin = 0;
+        while (const char *lf = (const char *) memchr(text.data() + begin, '\n', text.size() - begin))
+        {
+            size_t end = lf - text.data();
+            if (end > begin)
+                writer.write({&text[begin], end - begin});
+            if (!(end > 0 ? text[end - 1] == '\r' : afterCR))
+                writer.write({"\r", 1});
+            begin = end + 1;
+        }
+        if (text.size() > begin)
+            writer.write({&text[begin], text.size() - begin});
+        if (text.size() > 0)
+            afterCR = text[text.size() - 1] == '\r';
+    }
+
     static void processMouse(VTerm *vt, ushort what, const MouseEventType &mouse)
     {
         VTermModifier mod; int button;
@@ -192,8 +215,15 @@ namespace vtermemu
         return {fg, bg, style};
     }
 
+    // The attributes which 'convAttr' takes into account.
+    static constexpr VTermAttrMask convAttrMask = (VTermAttrMask) (
+          VTERM_ATTR_BOLD_MASK | VTERM_ATTR_UNDERLINE_MASK | VTERM_ATTR_ITALIC_MASK
+        | VTERM_ATTR_BLINK_MASK | VTERM_ATTR_REVERSE_MASK | VTERM_ATTR_STRIKE_MASK
+        | VTERM_ATTR_FOREGROUND_MASK | VTERM_ATTR_BACKGROUND_MASK
+    );
+
     static void convCell( TSpan<TScreenCell> cells, int x,
-                          const VTermScreenCell &vtCell )
+                          const VTermScreenCell &vtCell, const TColorAttr &attr )
     {
         if (vtCell.chars[0] == (uint32_t) -1) // Wide char trail.
         {
@@ -214,7 +244,63 @@ namespace vtermemu
             while (vtCell.chars[length])
                 ++length;
             TSpan<const uint32_t> text {vtCell.chars, max<size_t>(1, length)};
-            TText::drawStr(cells, x, text, 0, convAttr(vtCell));
+            TText::drawStr(cells, x, text, 0, attr);
+        }
+    }
+
+    static void drawRun( TSpan<TScreenCell> cells, VTermScreen *vtScreen,
+                         int y, int begin, int end, const TColorAttr &attr )
+    // Pre: the area must be within bounds and all of its cells must have the
+    // same attributes.
+    {
+        // Cells are fetched in batches so that printable ASCII characters,
+        // which are most of the text, can be found with vector instructions
+        // and written directly.
+        enum { batchSize = 128 };
+        enum : uint32_t { invalidChar = (uint32_t) -2 };
+        VTermScreenCell vtCells[batchSize];
+        uint32_t chars[batchSize];
+
+        TScreenCell asciiCell;
+        ::setChar(asciiCell, ' ');
+        ::setAttr(asciiCell, attr);
+
+        for (int x = begin; x < end; x += batchSize)
+        {
+            int count = min<int>(end - x, batchSize);
+            for (int i = 0; i < count; ++i)
+            {
+                auto &vtCell = vtCells[i];
+                if (!vterm_screen_get_cell(vtScreen, {y, x + i}, &vtCell))
+                    chars[i] = invalidChar;
+                else if (vtCell.chars[0] == 0)
+                    // Empty cells are displayed as blanks anyway.
+                    chars[i] = ' ';
+                else if (vtCell.chars[1] != 0)
+                    // Combining characters.
+                    chars[i] = (uint32_t) -1;
+                else
+                    chars[i] = vtCell.chars[0];
+            }
+
+            int i = 0;
+            while (i < count)
+            {
+                int asciiEnd = i + printableAsciiPrefix(&chars[i], count - i);
+                for (; i < asciiEnd; ++i)
+                {
+                    cells[x + i] = asciiCell;
+                    ::setChar(cells[x + i], (char) chars[i]);
+                }
+                if (i < count)
+                {
+                    if (chars[i] == invalidChar)
+                        cells[x + i] = {};
+                    else
+                        convCell(cells, x + i, vtCells[i], attr);
+                    ++i;
+                }
+            }
         }
     }
 
@@ -224,22 +310,150 @@ namespace vtermemu
     {
         dout << "drawLine(" << y << ", " << begin << ", " << end << ")" << std::endl;
         TSpan<TScreenCell> cells(&surface.at(y, 0), surface.size.x);
-        for (int x = begin; x < end; ++x)
+        int x = begin;
+        while (x < end)
         {
+            // Cells usually come in long runs with the same attributes, so
+            // convert them only once per run. Note that the extent's
+            // 'end_col' is inclusive.
             VTermScreenCell cell;
-            if (vterm_screen_get_cell(vtScreen, {y, x}, &cell))
-                convCell(cells, x, cell);
+            VTermRect extent;
+            extent.start_col = x;
+            extent.end_col = end;
+            int runEnd = x + 1;
+            if ( vterm_screen_get_cell(vtScreen, {y, x}, &cell) &&
+                 vterm_screen_get_attrs_extent(vtScreen, &extent, {y, x}, convAttrMask) )
+                runEnd = min(max(extent.end_col + 1, runEnd), end);
             else
-                cells[x] = {};
+                memset(&cell, 0, sizeof(cell));
+
+            drawRun(cells, vtScreen, y, x, runEnd, convAttr(cell));
+            x = runEnd;
         }
         surface.addDamageAtRow(y, begin, end);
     }
 
+    // Scrollback conversion.
+
+    static bool isBlankCell(const VTermScreenCell &cell)
+    {
+        static constexpr VTermScreenCellAttrs noAttrs {};
+        return cell.chars[0] == 0
+            && memcmp(&cell.attrs, &noAttrs, sizeof(noAttrs)) == 0
+            && VTERM_COLOR_IS_DEFAULT_FG(&cell.fg)
+            && VTERM_COLOR_IS_DEFAULT_BG(&cell.bg);
+    }
+
+    static void packAttrs(const VTermScreenCell &cell, uint32_t (&attrs)[3])
+    {
+        static_assert(sizeof(cell.attrs) <= sizeof(attrs[0]), "");
+        static_assert(sizeof(cell.fg) <= sizeof(attrs[1]), "");
+        memset(attrs, 0, sizeof(attrs));
+        memcpy(&attrs[0], &cell.attrs, sizeof(cell.attrs));
+        memcpy(&attrs[1], &cell.fg, sizeof(cell.fg));
+        memcpy(&attrs[2], &cell.bg, sizeof(cell.bg));
+    }
+
+    static void unpackAttrs(const uint32_t (&attrs)[3], VTermScreenCell &cell)
+    {
+        memcpy(&cell.attrs, &attrs[0], sizeof(cell.attrs));
+        memcpy(&cell.fg, &attrs[1], sizeof(cell.fg));
+        memcpy(&cell.bg, &attrs[2], sizeof(cell.bg));
+    }
+
+    static void packLine( std::vector<ScrollbackSpan> &spans, GrowArray &text,
+                          int cols, const VTermScreenCell *cells, bool wrapped )
+    {
+        // Limit the span size so that its text size always fits.
+        enum { maxSpanCells = 2048 };
+        spans.clear();
+        text.clear();
+
+        // Trailing blanks are restored when popping the line. The blanks of
+        // wrapped lines are kept, since they are followed by more text when
+        // the line is joined with the next one.
+        int end = cols;
+        while (!wrapped && end > 0 && isBlankCell(cells[end - 1]))
+            --end;
+
+        int x = 0;
+        while (x < end)
+        {
+            auto &cell = cells[x];
+            ScrollbackSpan cur;
+            cur.cells = 1;
+            cur.width = cell.width == 2 && x + 1 < cols ? 2 : 1;
+            cur.codepoints = 0;
+            if (cell.chars[0] != (uint32_t) -1)
+                while ( cur.codepoints < VTERM_MAX_CHARS_PER_CELL &&
+                        cell.chars[cur.codepoints] != 0 )
+                    ++cur.codepoints;
+            cur.textSize = 0;
+            for (int i = 0; i < cur.codepoints; ++i)
+            {
+                char buf[4];
+                size_t length = utf32To8(cell.chars[i], buf);
+                text.push(buf, length);
+                cur.textSize += length;
+            }
+            packAttrs(cell, cur.emulatorAttrs);
+
+            auto *last = spans.empty() ? nullptr : &spans.back();
+            if ( last && last->cells < maxSpanCells &&
+                 last->width == cur.width && last->codepoints == cur.codepoints &&
+                 memcmp(last->emulatorAttrs, cur.emulatorAttrs, sizeof(cur.emulatorAttrs)) == 0 )
+            {
+                ++last->cells;
+                last->textSize += cur.textSize;
+            }
+            else
+            {
+                cur.attr = convAttr(cell);
+                spans.push_back(cur);
+            }
+            x += cur.width;
+        }
+    }
+
+    static int unpackLine( const ScrollbackLine &line,
+                           int cols, VTermScreenCell *cells )
+    // Returns the number of columns filled.
+    {
+        int x = 0;
+        size_t textPos = 0;
+        for (auto &span : line.spans)
+            for (size_t i = 0; i < span.cells; ++i)
+            {
+                if (x + span.width > cols)
+                    return x;
+                auto &cell = cells[x];
+                memset(&cell, 0, sizeof(cell));
+                for (size_t j = 0; j < span.codepoints; ++j)
+                {
+                    size_t length = utf8SeqLength(line.text[textPos]);
+                    cell.chars[j] = utf8To32(line.text.substr(textPos, length));
+                    textPos += length;
+                }
+                cell.width = span.width;
+                unpackAttrs(span.emulatorAttrs, cell);
+                if (span.width == 2)
+                {
+                    auto &trail = cells[x + 1];
+                    trail = cell;
+                    memset(trail.chars, 0, sizeof(trail.chars));
+                    trail.chars[0] = (uint32_t) -1;
+                    trail.width = 1;
+                }
+                x += span.width;
+            }
+        return x;
+    }
+
 } // namespace vtermemu
 
 TerminalEmulator &VTermEmulatorFactory::create(TPoint size, Writer &clientDataWriter) noexcept
 {
-    return *new VTermEmulator(size, clientDataWriter);
+    return *new VTermEmulator(size, clientDataWriter, scrollbackDir);
 }
 
 TSpan<const EnvironmentVar> VTermEmulatorFactory::getCustomEnvironment() noexcept
@@ -253,9 +467,16 @@ TSpan<const EnvironmentVar> VTermEmulatorFactory::getCustomEnvironment() noexcep
     return customEnvironment;
 }
 
-VTermEmulator::VTermEmulator(TPoint size, Writer &aClientDataWriter) noexcept :
+VTermEmulator::VTermEmulator( TPoint size, Writer &aClientDataWriter,
+                              const char *scrollbackDir ) noexcept :
     clientDataWriter(aClientDataWriter)
 {
+    if (scrollbackDir)
+        if (auto *archive = ScrollbackArchive::open(scrollbackDir))
+            scrollback.lock([&] (auto &store) {
+                store.useArchive(archive, ScrollbackArchive::defaultMaxLines);
+            });
+
     // VTerm requires size to be at least 1.
     size.x = max(size.x, 1);
     size.y = max(size.y, 1);
@@ -322,6 +543,27 @@ void VTermEmulator::handleEvent(const TerminalEvent &event) noexcept
                 vterm_state_focus_out(vtState);
             break;
 
+        case TerminalEventType::Paste:
+        {
+            // The text is written directly rather than as keystrokes. If the
+            // client enabled bracketed paste, libvterm surrounds it with the
+            // corresponding sequences.
+            auto &paste = event.paste;
+            if (paste.begins)
+            {
+                vterm_keyboard_start_paste(vt);
+                pasteAfterCR = false;
+            }
+            writePastedText(clientDataWriter, {paste.data, paste.size}, pasteAfterCR);
+            if (paste.ends)
+                vterm_keyboard_end_paste(vt);
+            break;
+        }
+
+        case TerminalEventType::VisibilityChange:
+            visibleArea = event.visibilityChange;
+            break;
+
         default:
             break;
     }
@@ -345,6 +587,12 @@ void VTermEmulator::updateState(TerminalState &state) noexcept
         state.titleChanged = true;
         state.title = std::move(localState.title);
     }
+    state.wheelCaptured = localState.mouseEnabled || localState.altScreenEnabled;
+}
+
+ScrollbackStore *VTermEmulator::getScrollback() noexcept
+{
+    return &scrollback;
 }
 
 TPoint VTermEmulator::getSize() noexcept
@@ -364,6 +612,8 @@ void VTermEmulator::setSize(TPoint size) noexcept
         vterm_set_size(vt, size.y, size.x);
         damageByRow.resize(0);
         damageByRow.resize(size.y);
+        // The surface will be redrawn from scratch.
+        pendingMoves.clear();
     }
 }
 
@@ -372,16 +622,66 @@ void VTermEmulator::drawDamagedArea(TerminalSurface &surface) noexcept
     using namespace vtermemu;
     TPoint size = getSize();
     if (surface.size != size)
+    {
         surface.resize(size);
-    for (int y = 0; y < size.y; ++y)
+        pendingMoves.clear();
+    }
+    applyPendingMoves(surface);
+    // Cells which cannot be seen are not drawn, but they remain damaged so
+    // that they get drawn once they become visible.
+    auto &area = visibleArea;
+    for (int y = max(area.top, 0); y < min(area.bottom, size.y); ++y)
     {
         auto &damage = damageByRow[y];
-        int begin = max(damage.begin, 0);
-        int end = min(damage.end, size.x);
+        int begin = max(max(damage.begin, area.left), 0);
+        int end = min(min(damage.end, area.right), size.x);
         if (begin < end)
+        {
             drawLine(surface, vtScreen, y, begin, end);
-        damage = {};
+            // Only one range is kept per row, so if both sides remain
+            // damaged, the middle will be drawn again.
+            if (begin <= damage.begin && damage.end <= end)
+                damage = {};
+            else if (begin <= damage.begin)
+                damage.begin = end;
+            else if (damage.end <= end)
+                damage.end = begin;
+        }
+    }
+}
+
+void VTermEmulator::applyPendingMoves(TerminalSurface &surface) noexcept
+{
+    for (auto &move : pendingMoves)
+    {
+        auto &dest = move.dest;
+        auto &src = move.src;
+        int rows = dest.end_row - dest.start_row;
+        int cols = dest.end_col - dest.start_col;
+        if (rows <= 0 || cols <= 0)
+            continue;
+        // Rectangles are always within bounds, because the surface has the
+        // same size as the VTermScreen.
+        if (cols == surface.size.x && src.start_col == 0)
+            // Rows are contiguous, so move all of them at once.
+            memmove( &surface.at(dest.start_row, 0), &surface.at(src.start_row, 0),
+                     rows*cols*sizeof(TScreenCell) );
+        else
+        {
+            // Rows must be moved in the right order if the rectangles overlap.
+            bool downward = dest.start_row > src.start_row;
+            for (int i = 0; i < rows; ++i)
+            {
+                int j = downward ? rows - 1 - i : i;
+                memmove( &surface.at(dest.start_row + j, dest.start_col),
+                         &surface.at(src.start_row + j, src.start_col),
+                         cols*sizeof(TScreenCell) );
+            }
+        }
+        for (int y = dest.start_row; y < dest.end_row; ++y)
+            surface.addDamageAtRow(y, dest.start_col, dest.end_col);
     }
+    pendingMoves.clear();
 }
 
 void VTermEmulator::writeOutput(const char *data, size_t size)
@@ -405,7 +705,46 @@ int VTermEmulator::damage(VTermRect rect)
 int VTermEmulator::moverect(VTermRect dest, VTermRect src)
 {
     dout << "moverect(" << dest << ", " << src << ")" << std::endl;
-    return false;
+    if (pendingMoves.size() == maxPendingMoves)
+        // Let VTerm damage the destination instead. Applying so many moves
+        // would probably not be cheaper than redrawing.
+        return false;
+    if (!visibleArea.visible())
+        // The destination will not be drawn until the terminal becomes
+        // visible, so there is no point in moving cells in the meantime.
+        return false;
+
+    // Only vertical moves (scrolling) are handled. With horizontal ones, VTerm
+    // does not always keep track of the damage properly.
+    TPoint size = getSize();
+    if ( src.start_col != dest.start_col || src.end_col != dest.end_col ||
+         src.end_row - src.start_row != dest.end_row - dest.start_row ||
+         src.start_col < 0 || src.end_col > size.x ||
+         min(src.start_row, dest.start_row) < 0 ||
+         max(src.end_row, dest.end_row) > min<int>(size.y, (int) damageByRow.size()) )
+        return false;
+
+    // The cells which have not been drawn yet are moved too, so their
+    // damage has to be moved with them. The damage of the source rows is
+    // left in place, since that only causes some unnecessary redrawing.
+    int dy = dest.start_row - src.start_row;
+    bool downward = dy > 0;
+    for (int i = 0; i < src.end_row - src.start_row; ++i)
+    {
+        int y = downward ? src.end_row - 1 - i : src.start_row + i;
+        auto damage = damageByRow[y];
+        int begin = max(damage.begin, src.start_col);
+        int end = min(damage.end, src.end_col);
+        if (begin < end)
+        {
+            auto &destDamage = damageByRow[y + dy];
+            destDamage.begin = min(begin, destDamage.begin);
+            destDamage.end = max(end, destDamage.end);
+        }
+    }
+
+    pendingMoves.push_back({dest, src});
+    return true;
 }
 
 int VTermEmulator::movecursor(VTermPos pos, VTermPos oldpos, int visible)
@@ -464,17 +803,6 @@ int VTermEmulator::resize(int rows, int cols)
     return false;
 }
 
-int VTermEmulator::sb_pushline(int cols, const VTermScreenCell *cells)
-{
-    linestack.push(std::max(cols, 0), cells);
-    return true;
-}
-
-int VTermEmulator::sb_popline(int cols, VTermScreenCell *cells)
-{
-    return linestack.pop(*this, std::max(cols, 0), cells);
-}
-
 inline VTermScreenCell VTermEmulator::getDefaultCell() const
 {
     VTermScreenCell cell {};
@@ -483,32 +811,44 @@ inline VTermScreenCell VTermEmulator::getDefaultCell() const
     return cell;
 }
 
-void VTermEmulator::LineStack::push(size_t cols, const VTermScreenCell *src)
+int VTermEmulator::sb_pushline(int cols, const VTermScreenCell *cells)
 {
-    if (stack.size() < maxSize)
-    {
-        auto *line = new VTermScreenCell[cols];
-        memcpy(line, src, sizeof(VTermScreenCell)*cols);
-        stack.emplace_back(line, cols);
-    }
+    using namespace vtermemu;
+    // libvterm has already scrolled the line info when pushing lines, so the
+    // line which used to follow this one is now the first one. If the screen
+    // scrolled by several lines at once, this is only accurate for the last
+    // of them, but that is rare outside the alternate screen, whose lines are
+    // not pushed.
+    auto *lineInfo = vterm_state_get_lineinfo(vtState, 0);
+    bool wrapped = lineInfo && lineInfo->continuation;
+    // Convert the line before locking, so that the store is locked for as
+    // little time as possible.
+    packLine(scrollbackSpans, scrollbackText, max(cols, 0), cells, wrapped);
+    scrollback.lock([&] (auto &store) {
+        store.push(
+            {scrollbackSpans.data(), scrollbackSpans.size()},
+            {scrollbackText.data(), scrollbackText.size()},
+            wrapped
+        );
+    });
+    return true;
 }
 
-bool VTermEmulator::LineStack::pop( const VTermEmulator &vterm,
-                                    size_t cols, VTermScreenCell *dst )
+int VTermEmulator::sb_popline(int cols, VTermScreenCell *cells)
 {
-    if (!stack.empty())
-    {
-        auto line = top();
-        size_t dst_size = cols*sizeof(VTermScreenCell);
-        size_t copy_bytes = std::min(line.size_bytes(), dst_size);
-        memcpy(dst, line.data(), copy_bytes);
-        auto cell = vterm.getDefaultCell();
-        for (size_t i = line.size(); i < cols; ++i)
-            dst[i] = cell;
-        stack.pop_back();
-        return true;
-    }
-    return false;
+    using namespace vtermemu;
+    return scrollback.lock([&] (auto &store) {
+        ScrollbackLine line;
+        if (!store.empty() && store.getLine(store.endLine() - 1, line))
+        {
+            auto cell = getDefaultCell();
+            for (int x = unpackLine(line, cols, cells); x < cols; ++x)
+                cells[x] = cell;
+            store.pop();
+            return true;
+        }
+        return false;
+    });
 }
 
 } // namespace tvterm
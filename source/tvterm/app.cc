@@ -17,8 +17,11 @@
 #include "desk.h"
 #include "wnd.h"
 #include "apputil.h"
+#include "findall.h"
 #include <tvterm/termctrl.h>
+#include <tvterm/termview.h>
 #include <tvterm/vtermemu.h>
+#include <tvterm/scrollarchive.h>
 
 #include <stdlib.h>
 #include <signal.h>
@@ -40,16 +43,28 @@ int main(int, char**)
     app.shutDown();
 }
 
+// Maximum number of times per second the terminals are drawn.
+static int getFrameRate()
+{
+    enum { defaultFrameRate = 60, maxFrameRate = 1000 };
+    const char *fps = getenv("TVTERM_FPS");
+    int rate = fps ? atoi(fps) : 0;
+    return 0 < rate && rate <= maxFrameRate ? rate : (int) defaultFrameRate;
+}
+
 TVTermApp::TVTermApp() :
     TProgInit( &TVTermApp::initStatusLine,
                nullptr,
                &TVTermApp::initDeskTop
-             )
+             ),
+    framePeriod(std::chrono::microseconds(1000000/getFrameRate())),
+    defaultEventTimeout(eventTimeout)
 {
     disableCommands(tileCmds);
     for (ushort cmd : TerminalWindow::appConsts.focusedCmds())
         disableCommand(cmd);
-    newTerm();
+    if (!restoreTerms())
+        newTerm();
 }
 
 TStatusLine *TVTermApp::initStatusLine(TRect r)
@@ -90,6 +105,7 @@ void TVTermApp::handleEvent(TEvent &event)
             {
                 case cmMenu: openMenu(); break;
                 case cmNewTerm: newTerm(); break;
+                case cmFindAll: findAll(); break;
                 case cmChangeDir: changeDir(); break;
                 case cmTileCols: getDeskTop()->tileVertical(getTileRect()); break;
                 case cmTileRows: getDeskTop()->tileHorizontal(getTileRect()); break;
@@ -132,10 +148,21 @@ Boolean TVTermApp::valid(ushort command)
     return TApplication::valid(command);
 }
 
+void TVTermApp::getEvent(TEvent &event)
+{
+    TApplication::getEvent(event);
+    if (event.what != evNothing)
+        eventsSinceIdle = true;
+}
+
 void TVTermApp::idle()
 {
     TApplication::idle();
+    // Windows are only opened or closed as a result of an event, so there is
+    // no need to look at the desktop otherwise.
+    if (eventsSinceIdle)
     {
+        eventsSinceIdle = false;
         // Enable or disable the cmTile and cmCascade commands.
         auto isTileable =
             [] (TView *p, void *) -> Boolean { return p->options & ofTileable; };
@@ -143,8 +170,35 @@ void TVTermApp::idle()
             enableCommands(tileCmds);
         else
             disableCommands(tileCmds);
+        // Likewise, terminals are only covered or uncovered by other views as
+        // a result of an event.
+        tvterm::TerminalView::updateVisibilities();
+    }
+    drawTerminals();
+}
+
+void TVTermApp::drawTerminals()
+// Busy terminals would otherwise be drawn, and the screen flushed, as many
+// times as the main thread is woken up. Instead, their updates are gathered
+// into frames, so that the work done does not depend on how many terminals
+// are busy. An update following a quiet period is drawn right away.
+{
+    using namespace std::chrono;
+    using namespace tvterm;
+    auto now = steady_clock::now();
+    if (now >= nextFrame)
+    {
+        if (TerminalView::drawUpdated())
+            nextFrame = now + framePeriod;
+        eventTimeout = defaultEventTimeout;
+    }
+    else if (TerminalController::anyUpdated())
+    {
+        // The terminals will not wake us up again until we draw them, so
+        // wait for the next frame at most.
+        auto us = duration_cast<microseconds>(nextFrame - now).count();
+        eventTimeout = (int) ::max<int64_t>((us + 999)/1000, 1);
     }
-    message(this, evBroadcast, cmCheckTerminalUpdates, nullptr);
 }
 
 void TVTermApp::openMenu()
@@ -159,6 +213,8 @@ void TVTermApp::openMenu()
         *new TMenuItem("Tile (Rows First)", cmTileRows, 'H', hcNoContext, "~H~") +
         *new TMenuItem("Resize/Move", cmResize, 'R', hcNoContext, "~R~") +
         *new TMenuItem("Maximize/Restore", cmZoom, 'F', hcNoContext, "~F~") +
+        *new TMenuItem("Find Text", cmFind, 'S', hcNoContext, "~S~") +
+        *new TMenuItem("Find in All Terms", cmFindAll, 'A', hcNoContext, "~A~") +
         newLine() +
         ( *new TSubMenu("~M~ore...", kbNoKey, hcMenu) +
             *new TMenuItem("~C~hange working dir...", cmChangeDir, kbNoKey) +
@@ -190,15 +246,96 @@ static void onTermError(const char *reason)
     messageBox(mfError | mfOKButton, "Cannot create terminal: %s.", reason);
 };
 
+// Directory where the scrollback of the terminals is kept across sessions,
+// or null if it should only be kept in memory.
+static const char *getScrollbackDir()
+{
+    const char *dir = getenv("TVTERM_SCROLLBACK_DIR");
+    return dir && *dir ? dir : nullptr;
+}
+
 void TVTermApp::newTerm()
+{
+    using namespace tvterm;
+    std::string dir;
+    if (const char *baseDir = getScrollbackDir())
+        dir = ScrollbackArchive::createDirectory(baseDir);
+    openTerm(!dir.empty() ? dir.c_str() : nullptr);
+}
+
+bool TVTermApp::restoreTerms()
+// Opens a terminal for each scrollback left by a previous session.
+{
+    using namespace tvterm;
+    bool restored = false;
+    if (const char *baseDir = getScrollbackDir())
+        for (auto &dir : ScrollbackArchive::findUnused(baseDir))
+            restored |= openTerm(dir.c_str());
+    return restored;
+}
+
+bool TVTermApp::openTerm(const char *scrollbackDir)
 {
     using namespace tvterm;
     TRect r = deskTop->getExtent();
-    VTermEmulatorFactory factory;
+    VTermEmulatorFactory factory(scrollbackDir);
+    TerminalControllerOptions options;
+    // Falls back to epoll, and then to dedicated threads, where io_uring is
+    // not available.
+    options.ioBackend = TerminalIoBackend::IoUring;
     auto *termCtrl = TerminalController::create( TerminalWindow::viewSize(r),
-                                                 factory, onTermError );
+                                                 factory, onTermError, options );
     if (termCtrl)
         insertWindow(new TerminalWindow(r, *termCtrl));
+    return termCtrl != nullptr;
+}
+
+void TVTermApp::findAll()
+{
+    using namespace tvterm;
+    enum { maxMatches = 1000 };
+    char text[256] = "";
+    if ( inputBox("Find in All Terminals", "~T~ext", text, sizeof(text) - 1) != cmOK ||
+         !*text )
+        return;
+
+    std::vector<TerminalWindow *> windows;
+    message(deskTop, evBroadcast, cmGetTermWindows, &windows);
+    std::vector<ScrollbackStore *> stores;
+    std::vector<TerminalWindow *> storeWindows;
+    for (auto *window : windows)
+        if (auto *store = window->getScrollback())
+        {
+            stores.push_back(store);
+            storeWindows.push_back(window);
+        }
+
+    std::vector<FoundLine> lines;
+    for (auto &match : findInScrollbacks({stores.data(), stores.size()}, text, maxMatches))
+    {
+        auto *window = storeWindows[match.store];
+        const char *title = window->getTitle(0);
+        lines.push_back({window, title ? title : "Terminal", std::move(match)});
+    }
+    if (lines.empty())
+    {
+        messageBox(mfInformation | mfOKButton, "'%s' was not found in any terminal.", text);
+        return;
+    }
+
+    auto *dialog = new FindAllDialog(lines);
+    if (validView(dialog))
+    {
+        ushort result = deskTop->execView(dialog);
+        short selected = dialog->getSelected();
+        TObject::destroy(dialog);
+        if (result == cmOK && 0 <= selected && (size_t) selected < lines.size())
+        {
+            auto &line = lines[selected];
+            line.window->select();
+            line.window->showFoundLine(text, line.match.line);
+        }
+    }
 }
 
 void TVTermApp::changeDir()
@@ -5,6 +5,8 @@
 #define Uses_TCommandSet
 #include <tvision/tv.h>
 
+#include <chrono>
+
 class TVTermDesk;
 
 struct TVTermApp : public TApplication
@@ -17,6 +19,7 @@ struct TVTermApp : public TApplication
 
     TVTermDesk* getDeskTop();
 
+    void getEvent(TEvent &event) override;
     void handleEvent(TEvent &event) override;
     Boolean valid(ushort command) override;
     void idle() override;
@@ -27,8 +30,22 @@ struct TVTermApp : public TApplication
 
     void openMenu();
     void newTerm();
+    void findAll();
     void changeDir();
 
+private:
+
+    bool eventsSinceIdle {true};
+
+    // Terminals are drawn at most once per frame.
+    std::chrono::steady_clock::duration framePeriod;
+    std::chrono::steady_clock::time_point nextFrame {};
+    int defaultEventTimeout;
+
+    void drawTerminals();
+    bool restoreTerms();
+    bool openTerm(const char *scrollbackDir);
+
 };
 
 inline TVTermDesk* TVTermApp::getDeskTop()
@@ -9,11 +9,14 @@ enum : ushort
     cmReleaseInput,
     cmTileCols,
     cmTileRows,
+    cmFind,
     // Commands that cannot be deactivated.
     cmNewTerm = 1000,
     cmCheckTerminalUpdates,
     cmTerminalUpdated,
     cmGetOpenTerms,
+    cmFindAll,
+    cmGetTermWindows,
 };
 
 enum : ushort
@@ -0,0 +1,59 @@
+#define Uses_TScrollBar
+#define Uses_TButton
+#define Uses_TEvent
+#include <tvision/tv.h>
+
+#include "findall.h"
+
+#include <stdio.h>
+#include <time.h>
+
+FoundLinesViewer::FoundLinesViewer( const TRect &bounds, TScrollBar *aVScrollBar,
+                                    const std::vector<FoundLine> &aLines ) noexcept :
+    TListViewer(bounds, 1, nullptr, aVScrollBar),
+    lines(aLines)
+{
+    setRange((short) lines.size());
+}
+
+void FoundLinesViewer::getText(char *dest, short item, short maxLen)
+{
+    auto &line = lines[item];
+    char timeStr[16] = "--:--:--";
+    time_t t = (time_t) line.match.time;
+    if (t != 0)
+        if (struct tm *tm = localtime(&t))
+            strftime(timeStr, sizeof(timeStr), "%H:%M:%S", tm);
+    snprintf( dest, maxLen, "%s %s: %.*s", timeStr, line.title.c_str(),
+              (int) line.match.text.size(), line.match.text.data() );
+}
+
+FindAllDialog::FindAllDialog(const std::vector<FoundLine> &lines) noexcept :
+    TWindowInit(&TDialog::initFrame),
+    TDialog(TRect(0, 0, 76, 20), "Found in All Terminals")
+{
+    options |= ofCentered;
+    auto *vScrollBar = new TScrollBar(TRect(size.x - 3, 2, size.x - 2, size.y - 4));
+    insert(vScrollBar);
+    viewer = new FoundLinesViewer(TRect(2, 2, size.x - 3, size.y - 4), vScrollBar, lines);
+    insert(viewer);
+    insert(new TButton(TRect(size.x - 26, size.y - 3, size.x - 14, size.y - 1), "~G~o To", cmOK, bfDefault));
+    insert(new TButton(TRect(size.x - 13, size.y - 3, size.x - 2, size.y - 1), "Cancel", cmCancel, bfNormal));
+    viewer->select();
+}
+
+void FindAllDialog::handleEvent(TEvent &ev)
+{
+    TDialog::handleEvent(ev);
+    if ( ev.what == evBroadcast && ev.message.command == cmListItemSelected &&
+         ev.message.infoPtr == viewer )
+    {
+        endModal(cmOK);
+        clearEvent(ev);
+    }
+}
+
+short FindAllDialog::getSelected() const noexcept
+{
+    return viewer->focused;
+}
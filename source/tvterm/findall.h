@@ -0,0 +1,49 @@
+#ifndef TVTERM_FINDALL_H
+#define TVTERM_FINDALL_H
+
+#define Uses_TDialog
+#define Uses_TListViewer
+#include <tvision/tv.h>
+
+#include <tvterm/scrollfind.h>
+#include <string>
+#include <vector>
+
+class TerminalWindow;
+
+struct FoundLine
+{
+    TerminalWindow *window;
+    std::string title;
+    tvterm::ScrollbackMatch match;
+};
+
+class FoundLinesViewer : public TListViewer
+{
+    const std::vector<FoundLine> &lines;
+
+public:
+
+    // The lifetime of 'lines' must exceed that of 'this'.
+    FoundLinesViewer( const TRect &bounds, TScrollBar *aVScrollBar,
+                      const std::vector<FoundLine> &lines ) noexcept;
+
+    void getText(char *dest, short item, short maxLen) override;
+};
+
+// Lists the lines found in all the terminals. When executed, returns cmOK if
+// one was chosen, which is then 'getSelected()'.
+class FindAllDialog : public TDialog
+{
+    FoundLinesViewer *viewer;
+
+public:
+
+    // The lifetime of 'lines' must exceed that of 'this'.
+    FindAllDialog(const std::vector<FoundLine> &lines) noexcept;
+
+    void handleEvent(TEvent &ev) override;
+    short getSelected() const noexcept;
+};
+
+#endif // TVTERM_FINDALL_H
@@ -10,6 +10,7 @@ const tvterm::TVTermConstants TerminalWindow::appConsts =
     cmTerminalUpdated,
     cmGrabInput,
     cmReleaseInput,
+    cmFind,
     hcInputGrabbed,
 };
 
@@ -18,6 +19,8 @@ void TerminalWindow::handleEvent(TEvent &ev)
     if ( ev.what == evBroadcast &&
          ev.message.command == cmGetOpenTerms && !isDisconnected() )
         *(size_t *) ev.message.infoPtr += 1;
+    else if (ev.what == evBroadcast && ev.message.command == cmGetTermWindows)
+        ((std::vector<TerminalWindow *> *) ev.message.infoPtr)->push_back(this);
     else if( ev.what == evCommand && ev.message.command == cmZoom &&
              (!ev.message.infoPtr || ev.message.infoPtr == this) )
     {
@@ -4,6 +4,8 @@
 #include <tvterm/termwnd.h>
 #include <tvterm/consts.h>
 
+#include <vector>
+
 class TerminalWindow : public tvterm::BasicTerminalWindow
 {
 public: